@@ -0,0 +1,52 @@
+/*
+ * board_stub.c - host simulation of the board support and pico_unique_id
+ */
+
+#include <time.h>
+#include <stdio.h>
+
+#include "bsp/board.h"
+#include "hardware/timer.h"
+#include "pico/time.h"
+#include "pico/unique_id.h"
+
+static bool led;
+
+void board_init(void) {
+  led = false;
+}
+
+void board_led_write(bool state) {
+  led = state;
+}
+
+uint32_t board_millis(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t) ((ts.tv_sec * 1000u) + (ts.tv_nsec / 1000000u));
+}
+
+uint64_t time_us_64(void) {
+  static uint64_t boot;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  uint64_t now = ((uint64_t) ts.tv_sec * 1000000u) + ((uint64_t) ts.tv_nsec / 1000u);
+  if (boot == 0u) {
+    boot = now;
+  }
+  return now - boot;
+}
+
+#if !USBTMC_APP_DUAL_CORE
+// one thread: nobody waits for the event
+void __sev(void) {
+}
+#endif
+
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp) {
+  return time_us_64() >= timeout_timestamp;
+}
+
+void pico_get_unique_board_id_string(char *id_out, unsigned int len) {
+  snprintf(id_out, len, "%s", "E66038B7133A7A2F");
+}
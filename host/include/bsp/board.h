@@ -0,0 +1,23 @@
+/*
+ * board.h - host simulation stand-in for the TinyUSB board support package
+ */
+
+#ifndef HOST_BSP_BOARD_H
+#define HOST_BSP_BOARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+void board_init(void);
+void board_led_write(bool state);
+uint32_t board_millis(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // HOST_BSP_BOARD_H
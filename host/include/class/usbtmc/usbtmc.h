@@ -0,0 +1,146 @@
+/*
+ * usbtmc.h - host simulation stand-in for TinyUSB's USBTMC protocol definitions
+ *
+ * Field names and layouts follow TinyUSB src/class/usbtmc/usbtmc.h
+ */
+
+#ifndef HOST_CLASS_USBTMC_H
+#define HOST_CLASS_USBTMC_H
+
+#include <stdint.h>
+
+#define USBTMC_VERSION     0x0100
+#define USBTMC_488_VERSION 0x0100
+
+typedef enum {
+  USBTMC_MSGID_DEV_DEP_MSG_OUT         = 1u,
+  USBTMC_MSGID_DEV_DEP_MSG_IN          = 2u,
+  USBTMC_MSGID_VENDOR_SPECIFIC_MSG_OUT = 126u,
+  USBTMC_MSGID_VENDOR_SPECIFIC_IN      = 127u,
+  USBTMC_MSGID_USB488_TRIGGER          = 128u,
+} usbtmc_msgid_enum;
+
+typedef enum {
+  USBTMC_STATUS_SUCCESS                     = 0x01,
+  USBTMC_STATUS_PENDING                     = 0x02,
+  USBTMC_STATUS_FAILED                      = 0x80,
+  USBTMC_STATUS_TRANSFER_NOT_IN_PROGRESS    = 0x81,
+  USBTMC_STATUS_SPLIT_NOT_IN_PROGRESS       = 0x82,
+  USBTMC_STATUS_SPLIT_IN_PROGRESS           = 0x83,
+  USB488_STATUS_INTERRUPT_IN_BUSY           = 0x20,
+} usbtmc_status_enum;
+
+typedef struct TU_ATTR_PACKED {
+  uint8_t MsgID;
+  uint8_t bTag;
+  uint8_t bTagInverse;
+  uint8_t _reserved;
+} usbtmc_msg_header_t;
+
+typedef struct TU_ATTR_PACKED {
+  usbtmc_msg_header_t header;
+  uint8_t data[8];
+} usbtmc_msg_generic_t;
+
+typedef struct TU_ATTR_PACKED {
+  usbtmc_msg_header_t header;
+  uint32_t TransferSize;
+  struct TU_ATTR_PACKED {
+    unsigned int EOM : 1;
+  } bmTransferAttributes;
+  uint8_t _reserved[3];
+} usbtmc_msg_request_dev_dep_out;
+
+typedef struct TU_ATTR_PACKED {
+  usbtmc_msg_header_t header;
+  uint32_t TransferSize;
+  struct TU_ATTR_PACKED {
+    unsigned int TermCharEnabled : 1;
+  } bmTransferAttributes;
+  uint8_t TermChar;
+  uint8_t _reserved[2];
+} usbtmc_msg_request_dev_dep_in;
+
+typedef struct TU_ATTR_PACKED {
+  usbtmc_msg_header_t header;
+  uint32_t TransferSize;
+  struct TU_ATTR_PACKED {
+    uint8_t EOM : 1;
+    uint8_t UsingTermChar : 1;
+  } bmTransferAttributes;
+  uint8_t _reserved[3];
+} usbtmc_msg_dev_dep_msg_in_header_t;
+
+typedef struct TU_ATTR_PACKED {
+  uint8_t USBTMC_status;
+  uint8_t bmAbortBulkIn;
+  uint8_t _reserved[2];
+  uint32_t NBYTES_RXD_TXD;
+} usbtmc_check_abort_bulk_rsp_t;
+
+typedef struct TU_ATTR_PACKED {
+  uint8_t USBTMC_status;
+  struct TU_ATTR_PACKED {
+    unsigned int BulkInFifoBytes : 1;
+  } bmClear;
+} usbtmc_get_clear_status_rsp_t;
+
+typedef struct TU_ATTR_PACKED {
+  uint8_t USBTMC_status;
+  uint8_t bTag;
+  uint8_t statusByte;
+} usbtmc_read_stb_rsp_488_t;
+
+typedef struct TU_ATTR_PACKED {
+  struct TU_ATTR_PACKED {
+    unsigned int bTag : 7;
+    unsigned int one  : 1;
+  } bNotify1;
+  uint8_t StatusByte;
+} usbtmc_read_stb_interrupt_488_t;
+
+typedef struct TU_ATTR_PACKED {
+  uint8_t USBTMC_status;
+  uint8_t _reserved;
+  uint16_t bcdUSBTMC;
+  struct TU_ATTR_PACKED {
+    unsigned int listenOnly : 1;
+    unsigned int talkOnly : 1;
+    unsigned int supportsIndicatorPulse : 1;
+  } bmIntfcCapabilities;
+  struct TU_ATTR_PACKED {
+    unsigned int canEndBulkInOnTermChar : 1;
+  } bmDevCapabilities;
+  uint8_t _reserved2[6];
+  uint8_t _reserved3[12];
+} usbtmc_response_capabilities_t;
+
+typedef struct TU_ATTR_PACKED {
+  uint8_t USBTMC_status;
+  uint8_t _reserved;
+  uint16_t bcdUSBTMC;
+  struct TU_ATTR_PACKED {
+    unsigned int listenOnly : 1;
+    unsigned int talkOnly : 1;
+    unsigned int supportsIndicatorPulse : 1;
+  } bmIntfcCapabilities;
+  struct TU_ATTR_PACKED {
+    unsigned int canEndBulkInOnTermChar : 1;
+  } bmDevCapabilities;
+  uint8_t _reserved2[6];
+  uint16_t bcdUSB488;
+  struct TU_ATTR_PACKED {
+    unsigned int is488_2 : 1;
+    unsigned int supportsREN_GTL_LLO : 1;
+    unsigned int supportsTrigger : 1;
+  } bmIntfcCapabilities488;
+  struct TU_ATTR_PACKED {
+    unsigned int SCPI : 1;
+    unsigned int SR1 : 1;
+    unsigned int RL1 : 1;
+    unsigned int DT1 : 1;
+  } bmDevCapabilities488;
+  uint8_t _reserved3[8];
+} usbtmc_response_capabilities_488_t;
+
+#endif // HOST_CLASS_USBTMC_H
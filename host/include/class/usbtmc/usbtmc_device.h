@@ -0,0 +1,57 @@
+/*
+ * usbtmc_device.h - host simulation stand-in for TinyUSB's USBTMC device class API
+ *
+ * The application callbacks are the same ones the real class driver calls.
+ */
+
+#ifndef HOST_CLASS_USBTMC_DEVICE_H
+#define HOST_CLASS_USBTMC_DEVICE_H
+
+#include "class/usbtmc/usbtmc.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// callbacks implemented by the application (usb/usbtmc_app.c)
+#if (CFG_TUD_USBTMC_ENABLE_488)
+usbtmc_response_capabilities_488_t const * tud_usbtmc_get_capabilities_cb(void);
+#else
+usbtmc_response_capabilities_t const * tud_usbtmc_get_capabilities_cb(void);
+#endif
+
+void tud_usbtmc_open_cb(uint8_t interface_id);
+
+bool tud_usbtmc_msgBulkOut_start_cb(usbtmc_msg_request_dev_dep_out const * msgHeader);
+bool tud_usbtmc_msg_data_cb(void *data, size_t len, bool transfer_complete);
+void tud_usbtmc_bulkOut_clearFeature_cb(void);
+
+bool tud_usbtmc_msgBulkIn_request_cb(usbtmc_msg_request_dev_dep_in const * request);
+bool tud_usbtmc_msgBulkIn_complete_cb(void);
+void tud_usbtmc_bulkIn_clearFeature_cb(void);
+
+bool tud_usbtmc_initiate_abort_bulk_in_cb(uint8_t *tmcResult);
+bool tud_usbtmc_initiate_abort_bulk_out_cb(uint8_t *tmcResult);
+bool tud_usbtmc_initiate_clear_cb(uint8_t *tmcResult);
+
+bool tud_usbtmc_check_abort_bulk_in_cb(usbtmc_check_abort_bulk_rsp_t *rsp);
+bool tud_usbtmc_check_abort_bulk_out_cb(usbtmc_check_abort_bulk_rsp_t *rsp);
+bool tud_usbtmc_check_clear_cb(usbtmc_get_clear_status_rsp_t *rsp);
+
+bool tud_usbtmc_indicator_pulse_cb(tusb_control_request_t const * msg, uint8_t *tmcResult);
+
+#if (CFG_TUD_USBTMC_ENABLE_488)
+uint8_t tud_usbtmc_get_stb_cb(uint8_t *tmcResult);
+bool tud_usbtmc_msg_trigger_cb(usbtmc_msg_generic_t* msg);
+#endif
+
+// API used by the application
+bool tud_usbtmc_transmit_dev_msg_data(const void * data, size_t len,
+    bool endOfMessage, bool usingTermChar);
+bool tud_usbtmc_start_bus_read(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // HOST_CLASS_USBTMC_DEVICE_H
@@ -0,0 +1,21 @@
+/*
+ * usbd_pvt.h - host simulation stand-in for TinyUSB's endpoint API
+ */
+
+#ifndef HOST_DEVICE_USBD_PVT_H
+#define HOST_DEVICE_USBD_PVT_H
+
+#include "tusb.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+bool usbd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t * buffer, uint16_t total_bytes);
+bool usbd_edpt_busy(uint8_t rhport, uint8_t ep_addr);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // HOST_DEVICE_USBD_PVT_H
@@ -0,0 +1,49 @@
+/*
+ * sync.h - host simulation stand-in for hardware_sync
+ *
+ * Spin locks and barriers on top of C11 atomics, for the dual core build
+ * where the two cores are threads.
+ */
+
+#ifndef HOST_HARDWARE_SYNC_H
+#define HOST_HARDWARE_SYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+typedef atomic_flag spin_lock_t;
+
+spin_lock_t *spin_lock_instance(unsigned int lock_num);
+int spin_lock_claim_unused(bool required);
+uint32_t spin_lock_blocking(spin_lock_t *lock);
+void spin_unlock(spin_lock_t *lock, uint32_t saved_irq);
+
+// the core (thread) that calls
+unsigned int get_core_num(void);
+
+static inline void __dmb(void) {
+  atomic_thread_fence(memory_order_seq_cst);
+}
+
+// no interrupts in the simulation
+static inline uint32_t save_and_disable_interrupts(void) {
+  return 0u;
+}
+
+static inline void restore_interrupts(uint32_t status) {
+  (void) status;
+}
+
+void __sev(void);
+void __wfe(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // HOST_HARDWARE_SYNC_H
@@ -0,0 +1,25 @@
+/*
+ * timer.h - host simulation stand-in for hardware_timer
+ */
+
+#ifndef HOST_HARDWARE_TIMER_H
+#define HOST_HARDWARE_TIMER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// us since boot (since the first call, in the simulation)
+uint64_t time_us_64(void);
+
+static inline uint32_t time_us_32(void) {
+  return (uint32_t) time_us_64();
+}
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // HOST_HARDWARE_TIMER_H
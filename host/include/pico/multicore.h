@@ -0,0 +1,22 @@
+/*
+ * multicore.h - host simulation stand-in for pico_multicore
+ *
+ * Core 1 is a thread.
+ */
+
+#ifndef HOST_PICO_MULTICORE_H
+#define HOST_PICO_MULTICORE_H
+
+#include "hardware/sync.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+void multicore_launch_core1(void (*entry)(void));
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // HOST_PICO_MULTICORE_H
@@ -0,0 +1,20 @@
+/*
+ * platform.h - host simulation stand-in for pico_platform
+ */
+
+#ifndef HOST_PICO_PLATFORM_H
+#define HOST_PICO_PLATFORM_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// body of a busy wait loop
+static inline void tight_loop_contents(void) {
+}
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // HOST_PICO_PLATFORM_H
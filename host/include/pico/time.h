@@ -0,0 +1,29 @@
+/*
+ * time.h - host simulation stand-in for pico_time
+ */
+
+#ifndef HOST_PICO_TIME_H
+#define HOST_PICO_TIME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hardware/timer.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+typedef uint64_t absolute_time_t;
+
+static inline absolute_time_t from_us_since_boot(uint64_t us) {
+  return us;
+}
+
+// the simulated host runs in the same thread: never waits, true when the time has passed
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // HOST_PICO_TIME_H
@@ -0,0 +1,22 @@
+/*
+ * unique_id.h - host simulation stand-in for pico_unique_id
+ */
+
+#ifndef HOST_PICO_UNIQUE_ID_H
+#define HOST_PICO_UNIQUE_ID_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#define PICO_UNIQUE_BOARD_ID_SIZE_BYTES 8
+
+void pico_get_unique_board_id_string(char *id_out, unsigned int len);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // HOST_PICO_UNIQUE_ID_H
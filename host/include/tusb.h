@@ -0,0 +1,78 @@
+/*
+ * tusb.h - host simulation stand-in for TinyUSB
+ *
+ * Only covers what the lablib uses: the USBTMC device class API,
+ * the vendor class write side, the tud_task() event pump and a few tu_ helpers.
+ * The class behaviour itself lives in host/tusb_stub.c
+ */
+
+#ifndef HOST_TUSB_H
+#define HOST_TUSB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+// option values referenced by tusb_config.h
+#define OPT_MCU_NONE            0
+#define OPT_OS_NONE             1
+#define OPT_MODE_FULL_SPEED     0x0000
+#define OPT_MODE_HIGH_SPEED     0x0400
+#define OPT_MODE_DEFAULT_SPEED  OPT_MODE_FULL_SPEED
+
+#include "tusb_config.h"
+
+#define TUD_OPT_HIGH_SPEED      0
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#define TU_ATTR_PACKED __attribute__ ((packed))
+
+// TinyUSB's TU_ASSERT / TU_VERIFY return false (or the given value) when the condition fails
+#define TU_ASSERT_1ARG(_cond)         do { if (!(_cond)) return false; } while(0)
+#define TU_ASSERT_2ARGS(_cond, _ret)  do { if (!(_cond)) return _ret; } while(0)
+#define TU_GET_3RD_ARG(arg1, arg2, arg3, ...) arg3
+#define TU_ASSERT(...) TU_GET_3RD_ARG(__VA_ARGS__, TU_ASSERT_2ARGS, TU_ASSERT_1ARG, UNUSED)(__VA_ARGS__)
+#define TU_VERIFY(...) TU_ASSERT(__VA_ARGS__)
+
+static inline uint32_t tu_min32(uint32_t x, uint32_t y) { return (x < y) ? x : y; }
+static inline uint32_t tu_max32(uint32_t x, uint32_t y) { return (x > y) ? x : y; }
+
+typedef struct TU_ATTR_PACKED {
+  uint8_t  bmRequestType;
+  uint8_t  bRequest;
+  uint16_t wValue;
+  uint16_t wIndex;
+  uint16_t wLength;
+} tusb_control_request_t;
+
+typedef enum {
+  TUSB_SPEED_FULL = 0,
+  TUSB_SPEED_LOW  = 1,
+  TUSB_SPEED_HIGH = 2,
+} tusb_speed_t;
+
+void tud_task(void);
+bool tud_task_event_ready(void);
+bool tud_mounted(void);
+
+// device callbacks, implemented by the application (usb/usb_utils.c)
+void tud_mount_cb(void);
+void tud_umount_cb(void);
+void tud_suspend_cb(bool remote_wakeup_en);
+void tud_resume_cb(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#include "class/usbtmc/usbtmc.h"
+#include "class/usbtmc/usbtmc_device.h"
+#if CFG_TUD_VENDOR
+#include "class/vendor/vendor_device.h"
+#endif
+
+#endif // HOST_TUSB_H
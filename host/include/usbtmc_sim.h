@@ -0,0 +1,94 @@
+/*
+ * usbtmc_sim.h - simulated USBTMC host for the host (Linux) build
+ *
+ * The functions below play the role of the PC side of the cable.
+ * They queue USBTMC bulk messages and control requests, then pump the
+ * simulated device main loop (usbtmc_sched_run()) until
+ * the device has answered, the same way a VISA session would see it.
+ */
+
+#ifndef USBTMC_SIM_H
+#define USBTMC_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// bulk endpoint size, matches desc_fs_configuration
+#define USBTMC_SIM_PACKET_SIZE 64u
+// device main loop iterations a read waits before it's considered timed out
+#define USBTMC_SIM_READ_TIMEOUT_POLLS 100000u
+// ... and the minimum time (VISA default timeout), for when the SCPI engine runs on its own thread
+#define USBTMC_SIM_READ_TIMEOUT_MS 2000u
+
+// one iteration of the firmware main loop. Override with usbtmc_sim_set_device_loop()
+void usbtmc_sim_device_loop(void);
+void usbtmc_sim_set_device_loop(void (*loop)(void));
+void usbtmc_sim_poll(void);
+
+// enumerate: opens the USBTMC interface
+void usbtmc_sim_connect(void);
+
+// DEV_DEP_MSG_OUT: send a program message, split in bulk packets
+bool usbtmc_sim_write(const void *data, size_t len, bool eom);
+// same, but only queue the packets. The device takes them during the next call that polls.
+// for scripts where the host sends while the device waits for it (e.g. a query that's never read)
+void usbtmc_sim_post_write(const void *data, size_t len, bool eom);
+// REQUEST_DEV_DEP_MSG_IN + the matching Bulk-IN transfer.
+// returns number of payload bytes received, 0 on timeout
+size_t usbtmc_sim_read(void *data, size_t transfer_size, bool *eom);
+size_t usbtmc_sim_read_termchar(void *data, size_t transfer_size, uint8_t term_char, bool *eom);
+// read the vendor bulk stream (PSL_VENDOR_STREAM) until max bytes, or the timeout.
+// returns the bytes read
+size_t usbtmc_sim_stream_read(void *data, size_t max);
+// write a message and read the reply until EOM. returns reply length
+size_t usbtmc_sim_query(const char *cmd, char *reply, size_t max);
+// TransferSize of the host's Bulk-IN requests, 0: as large as the read buffer
+void usbtmc_sim_set_transfer_size(uint32_t transfer_size);
+// termination character of the queries' Bulk-IN requests: a read ends after it, or at EOM
+void usbtmc_sim_set_term_char(bool enabled, uint8_t term_char);
+
+// USB488 TRIGGER bulk message
+bool usbtmc_sim_trigger(void);
+// USB488 READ_STATUS_BYTE control request
+uint8_t usbtmc_sim_read_stb(void);
+// INITIATE_CLEAR + CHECK_CLEAR_STATUS control requests
+bool usbtmc_sim_clear(void);
+// USBTMC INDICATOR_PULSE control request
+bool usbtmc_sim_indicator_pulse(void);
+// pop a notification the device queued on the interrupt IN endpoint
+bool usbtmc_sim_poll_interrupt(uint8_t *bNotify1, uint8_t *status_byte);
+
+// one line of a traffic script: a program message (a query when it has a '?'), or a
+// USBTMC / USB488 request: !trg TRIGGER, !stb READ_STATUS_BYTE, !clr clear, !int poll the interrupt endpoint,
+// !str <n> read n samples from the stream, !tc <n> TermChar n for the queries (none: off), !rd read the rest of a reply,
+// !idle <ms> run the device loop for ms without traffic,
+// !exp <text> the line before got back text, where * matches any characters on one line, !nexp <text> it didn't:
+// a mismatch is reported on stderr and counted.
+// returns the length of what the host got back, as a line of text
+size_t usbtmc_sim_script_line(const char *line, char *reply, size_t max);
+// !exp and !nexp lines that failed, since the start
+uint32_t usbtmc_sim_expect_failures(void);
+
+// traffic counters, handy when profiling
+typedef struct {
+  uint32_t out_packets;
+  uint32_t in_transfers;
+  uint64_t out_bytes;
+  uint64_t in_bytes;
+  uint32_t stalls;
+  uint64_t stream_bytes;
+} usbtmc_sim_stats_t;
+
+usbtmc_sim_stats_t const * usbtmc_sim_get_stats(void);
+void usbtmc_sim_reset_stats(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // USBTMC_SIM_H
@@ -0,0 +1,311 @@
+/*
+ * scpi-def.c - minimal instrument used by the host simulation build
+ */
+
+#include "scpi-def.h"
+#include "scpi/scpi_base.h"
+#include "bsp/board.h"
+
+#define SIM_SAMPLES_COUNT 4096u
+
+static int32_t sim_value;
+static int16_t sim_samples[SIM_SAMPLES_COUNT];
+#if SCPI_ACQUIRE
+static bool sim_acquire_run;
+static int16_t sim_acquire_next;
+#endif
+
+// SIMulate:LOAD: a periodic instrument task
+#define SIM_LOAD_PERIOD_US 10000u
+static int sim_load_task = -1;
+static uint32_t sim_load_ms;
+
+static void SIM_LoadTask(void * context) {
+  (void) context;
+  uint32_t start = board_millis();
+  while ((board_millis() - start) < sim_load_ms) {
+  }
+}
+
+#if SCPI_ACQUIRE
+static void SIM_AcquireControl(bool run, void * context) {
+  (void) context;
+  sim_acquire_run = run;
+  sim_acquire_next = 0;
+}
+#endif
+
+void initInstrument() {
+  sim_value = 0;
+  for (size_t i = 0; i < SIM_SAMPLES_COUNT; i++) {
+    sim_samples[i] = (int16_t) (i * 16);
+  }
+#if SCPI_ACQUIRE
+  scpi_acquire_init(SIM_AcquireControl, NULL);
+#endif
+  sim_load_ms = 0u;
+  if (sim_load_task < 0) { // before the main loop starts, *RST doesn't add it again
+    sim_load_task = usbtmc_sched_add("SIM", SIM_LoadTask, NULL, USBTMC_SCHED_PRIORITY_INSTRUMENT, SIM_LOAD_PERIOD_US, 0u);
+  }
+}
+
+/**
+ * SIMulate:VALue - store an integer, SIMulate:VALue? reads it back
+ */
+static scpi_result_t SIM_Value(scpi_t * context) {
+  int32_t value;
+  if (!SCPI_ParamInt32(context, &value, TRUE)) {
+    return SCPI_RES_ERR;
+  }
+  sim_value = value;
+  return SCPI_RES_OK;
+}
+
+static scpi_result_t SIM_ValueQ(scpi_t * context) {
+  SCPI_ResultInt32(context, sim_value);
+  return SCPI_RES_OK;
+}
+
+/**
+ * SIMulate:BLOCk? <count> - reply with a <count> byte definite length block,
+ * to exercise long replies
+ */
+static scpi_result_t SIM_BlockQ(scpi_t * context) {
+  static const char pattern[] = "0123456789ABCDEF";
+  int32_t count;
+  if (!SCPI_ParamInt32(context, &count, TRUE)) {
+    return SCPI_RES_ERR;
+  }
+  if (count < 0) {
+    SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+    return SCPI_RES_ERR;
+  }
+  SCPI_ResultArbitraryBlockHeader(context, (size_t) count);
+  for (int32_t i = 0; i < count; i += (int32_t) (sizeof(pattern) - 1)) {
+    size_t len = (size_t) (count - i);
+    if (len > sizeof(pattern) - 1) {
+      len = sizeof(pattern) - 1;
+    }
+    SCPI_ResultArbitraryBlockData(context, pattern, len);
+  }
+  return SCPI_RES_OK;
+}
+
+/**
+ * SIMulate:SAMPles? <count> - reply with <count> 16 bit samples as a definite length block.
+ * The block is sent straight from the sample table, without copying.
+ */
+static size_t SIM_SamplesProducer(void *context, size_t offset, size_t max, const uint8_t **data) {
+  (void) context;
+  size_t table = sizeof(sim_samples);
+  size_t pos = offset % table; // longer blocks wrap around the table
+  *data = (const uint8_t *) sim_samples + pos;
+  return (max < table - pos) ? max : table - pos;
+}
+
+static scpi_result_t SIM_SamplesQ(scpi_t * context) {
+  int32_t count;
+  if (!SCPI_ParamInt32(context, &count, TRUE)) {
+    return SCPI_RES_ERR;
+  }
+  if (count < 0) {
+    SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+    return SCPI_RES_ERR;
+  }
+  SCPI_ResultBlockProducer(context, (size_t) count * sizeof(int16_t), SIM_SamplesProducer, NULL);
+  return SCPI_RES_OK;
+}
+
+/**
+ * SIMulate:ARRay? <count> - the first <count> samples, in the format set with FORMat:DATA
+ */
+static scpi_result_t SIM_ArrayQ(scpi_t * context) {
+  uint32_t count;
+  if (!SCPI_ParamUInt32(context, &count, TRUE)) {
+    return SCPI_RES_ERR;
+  }
+  if (count > SIM_SAMPLES_COUNT) {
+    SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+    return SCPI_RES_ERR;
+  }
+  SCPI_ResultDataArrayInt16(context, sim_samples, count);
+  return SCPI_RES_OK;
+}
+
+#if SCPI_ACQUIRE
+/**
+ * SIMulate:ACQuire <count> - plays the acquisition producer: writes a <count> sample ramp
+ * into the ring the way a DMA transfer would. Needs INITiate:CONTinuous ON
+ */
+static scpi_result_t SIM_Acquire(scpi_t * context) {
+  uint32_t count;
+  if (!SCPI_ParamUInt32(context, &count, TRUE)) {
+    return SCPI_RES_ERR;
+  }
+  while (sim_acquire_run && count) {
+    int16_t *space;
+    size_t len = scpi_acquire_space(&space);
+    if (!len) {
+      scpi_acquire_overrun(count);
+      break;
+    }
+    len = (len < count) ? len : count;
+    for (size_t i = 0; i < len; i++) {
+      space[i] = sim_acquire_next++;
+    }
+    scpi_acquire_commit(len);
+    count -= (uint32_t) len;
+  }
+  return SCPI_RES_OK;
+}
+#endif
+
+#if SCPI_TRACE
+/**
+ * SIMulate:TRACe <name>,<count> - append <count> points to a trace: 0.5, 1, 1.5, ...
+ * after the points that are already there
+ */
+static scpi_result_t SIM_Trace(scpi_t * context) {
+  const char *name;
+  size_t len;
+  uint32_t count;
+  if (!SCPI_ParamCharacters(context, &name, &len, TRUE) || !SCPI_ParamUInt32(context, &count, TRUE)) {
+    return SCPI_RES_ERR;
+  }
+  scpi_trace_t trace = scpi_trace_find(name, len);
+  for (uint32_t i = 0; i < count; i++) {
+    if (!scpi_trace_append(trace, (float) (i + 1u) * 0.5f)) {
+      SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+      return SCPI_RES_ERR;
+    }
+  }
+  return SCPI_RES_OK;
+}
+#endif
+
+/**
+ * SIMulate:BUSY <ms> - a slow instrument callback, keeps the SCPI engine busy for <ms>
+ */
+static scpi_result_t SIM_Busy(scpi_t * context) {
+  int32_t ms;
+  if (!SCPI_ParamInt32(context, &ms, TRUE)) {
+    return SCPI_RES_ERR;
+  }
+  uint32_t start = board_millis();
+  while ((int32_t) (board_millis() - start) < ms) {
+  }
+  return SCPI_RES_OK;
+}
+
+/**
+ * SIMulate:LOAD <ms> - the instrument task that runs every 10 ms takes <ms>. SYSTem:TASK? shows
+ * its deadlines, and what it does to USB's
+ */
+static scpi_result_t SIM_Load(scpi_t * context) {
+  int32_t ms;
+  if (!SCPI_ParamInt32(context, &ms, TRUE)) {
+    return SCPI_RES_ERR;
+  }
+  if (ms < 0) {
+    SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+    return SCPI_RES_ERR;
+  }
+  sim_load_ms = (uint32_t) ms;
+  return SCPI_RES_OK;
+}
+
+/**
+ * SIMulate:SETTle <ms> - overlapped command: returns right away, the operation completes after <ms>.
+ * Use *OPC, *OPC? or *WAI to wait for it
+ */
+static uint32_t sim_settle_until;
+
+static bool SIM_SettlePoll(void * context) {
+  (void) context;
+  return (int32_t) (board_millis() - sim_settle_until) >= 0;
+}
+
+static scpi_result_t SIM_Settle(scpi_t * context) {
+  int32_t ms;
+  if (!SCPI_ParamInt32(context, &ms, TRUE)) {
+    return SCPI_RES_ERR;
+  }
+  if (scpi_operation_pending()) { // one settle at a time
+    SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+    return SCPI_RES_ERR;
+  }
+  sim_settle_until = board_millis() + (uint32_t) ms;
+  scpi_operation_start(SIM_SettlePoll, NULL);
+  return SCPI_RES_OK;
+}
+
+/**
+ * SIMulate:TRIGger:VALue <n> - SIMulate:VALue becomes <n> on the next trigger.
+ * Use with TRIGger:SOURce BUS, INITiate and *TRG or the USB488 TRIGGER message
+ */
+static int32_t sim_trigger_value;
+
+static void SIM_TriggerAction(void * context) {
+  sim_value = *(int32_t *) context;
+}
+
+static scpi_result_t SIM_TriggerValue(scpi_t * context) {
+  int32_t value;
+  if (!SCPI_ParamInt32(context, &value, TRUE)) {
+    return SCPI_RES_ERR;
+  }
+  sim_trigger_value = value;
+  if (!scpi_trigger_arm(SIM_TriggerAction, &sim_trigger_value)) {
+    SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+    return SCPI_RES_ERR;
+  }
+  return SCPI_RES_OK;
+}
+
+/**
+ * SIMulate:QUEStionable <bits>, SIMulate:OPERation <bits> - the condition register becomes <bits>,
+ * the way an interrupt handler would set and clear them
+ */
+static scpi_result_t sim_condition(scpi_t * context, scpi_status_register_t reg) {
+  uint32_t bits;
+  if (!SCPI_ParamUInt32(context, &bits, TRUE)) {
+    return SCPI_RES_ERR;
+  }
+  scpi_status_clear(reg, (uint16_t) ~bits);
+  scpi_status_set(reg, (uint16_t) bits);
+  return SCPI_RES_OK;
+}
+
+static scpi_result_t SIM_Questionable(scpi_t * context) {
+  return sim_condition(context, SCPI_STATUS_QUESTIONABLE);
+}
+
+static scpi_result_t SIM_Operation(scpi_t * context) {
+  return sim_condition(context, SCPI_STATUS_OPERATION);
+}
+
+const scpi_command_t scpi_commands[] = {
+  SCPI_BASE_COMMANDS
+  {.pattern = "SIMulate:VALue", .callback = SIM_Value,},
+  {.pattern = "SIMulate:VALue?", .callback = SIM_ValueQ,},
+  {.pattern = "SIMulate:BLOCk?", .callback = SIM_BlockQ,},
+  {.pattern = "SIMulate:SAMPles?", .callback = SIM_SamplesQ,},
+  {.pattern = "SIMulate:ARRay?", .callback = SIM_ArrayQ,},
+#if SCPI_ACQUIRE
+  {.pattern = "SIMulate:ACQuire", .callback = SIM_Acquire,},
+#endif
+#if SCPI_TRACE
+  {.pattern = "SIMulate:TRACe", .callback = SIM_Trace,},
+#endif
+  {.pattern = "SIMulate:BUSY", .callback = SIM_Busy,},
+  {.pattern = "SIMulate:LOAD", .callback = SIM_Load,},
+  {.pattern = "SIMulate:SETTle", .callback = SIM_Settle,},
+  {.pattern = "SIMulate:TRIGger:VALue", .callback = SIM_TriggerValue,},
+  {.pattern = "SIMulate:QUEStionable", .callback = SIM_Questionable,},
+  {.pattern = "SIMulate:OPERation", .callback = SIM_Operation,},
+  SCPI_CMD_LIST_END
+};
+
+scpi_units_def_t scpi_units_def[] = {
+  SCPI_UNITS_LIST_END,
+};
@@ -0,0 +1,22 @@
+/*
+ * scpi-def.h - minimal instrument used by the host simulation build
+ *
+ * A firmware project provides its own scpi-def.h. This one only offers the
+ * lablib base commands plus a few queries to exercise the reply path.
+ */
+
+#ifndef HOST_SCPI_DEF_H
+#define HOST_SCPI_DEF_H
+
+#include "scpi/scpi.h"
+
+#define SCPI_IDN1 "PICO-PI"
+#define SCPI_IDN2 "LABTOOL-SIM"
+#define SCPI_IDN4 "01.00"
+
+extern const scpi_command_t scpi_commands[];
+extern scpi_units_def_t scpi_units_def[];
+
+void initInstrument();
+
+#endif // HOST_SCPI_DEF_H
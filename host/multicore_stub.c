@@ -0,0 +1,87 @@
+/*
+ * multicore_stub.c - host simulation of pico_multicore and hardware_sync
+ *
+ * The thread that calls main() is core 0, multicore_launch_core1() starts core 1.
+ * WFE/SEV become a condition variable, so that a waiting core doesn't burn the CPU
+ * that the other one needs.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "pico/multicore.h"
+
+#define SPIN_LOCK_COUNT 32u
+
+static spin_lock_t spin_locks[SPIN_LOCK_COUNT];
+static unsigned int spin_locks_claimed;
+static _Thread_local unsigned int core_num;
+
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t event_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int event_count;
+static _Thread_local unsigned int event_seen;
+
+spin_lock_t *spin_lock_instance(unsigned int lock_num) {
+  return &spin_locks[lock_num % SPIN_LOCK_COUNT];
+}
+
+int spin_lock_claim_unused(bool required) {
+  (void) required;
+  unsigned int lock_num = spin_locks_claimed++;
+  atomic_flag_clear(&spin_locks[lock_num % SPIN_LOCK_COUNT]);
+  return (int) lock_num;
+}
+
+uint32_t spin_lock_blocking(spin_lock_t *lock) {
+  while (atomic_flag_test_and_set_explicit(lock, memory_order_acquire)) {
+    sched_yield();
+  }
+  return 0u;
+}
+
+void spin_unlock(spin_lock_t *lock, uint32_t saved_irq) {
+  (void) saved_irq;
+  atomic_flag_clear_explicit(lock, memory_order_release);
+}
+
+unsigned int get_core_num(void) {
+  return core_num;
+}
+
+void __sev(void) {
+  pthread_mutex_lock(&event_mutex);
+  event_count++;
+  pthread_cond_broadcast(&event_cond);
+  pthread_mutex_unlock(&event_mutex);
+}
+
+// returns on an event the caller hasn't seen yet, or after a short while (like a spurious wake up)
+void __wfe(void) {
+  struct timespec until;
+  clock_gettime(CLOCK_REALTIME, &until);
+  until.tv_nsec += 1000000;
+  if (until.tv_nsec >= 1000000000) {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000;
+  }
+  pthread_mutex_lock(&event_mutex);
+  if (event_seen == event_count) {
+    pthread_cond_timedwait(&event_cond, &event_mutex, &until);
+  }
+  event_seen = event_count;
+  pthread_mutex_unlock(&event_mutex);
+}
+
+static void *core1_thread(void *arg) {
+  core_num = 1u;
+  ((void (*)(void)) arg)();
+  return NULL;
+}
+
+void multicore_launch_core1(void (*entry)(void)) {
+  pthread_t thread;
+  pthread_create(&thread, NULL, core1_thread, (void *) entry);
+  pthread_detach(thread);
+}
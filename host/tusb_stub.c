@@ -0,0 +1,707 @@
+/*
+ * tusb_stub.c - host simulation of the TinyUSB USBTMC device class
+ *
+ * Device side: a cut down version of TinyUSB's class/usbtmc/usbtmc_device.c
+ * state machine. It calls the same tud_usbtmc_*_cb callbacks as the real
+ * driver, in the same order, and it only delivers a Bulk-OUT packet when the
+ * application has armed the endpoint with tud_usbtmc_start_bus_read().
+ * Bulk-IN data is copied to the host when tud_task() handles the transfer
+ * complete event, so the application's buffer has to stay valid until then,
+ * like on the real hardware.
+ * With CFG_TUD_VENDOR, the vendor interface's TX FIFO holds the stream until
+ * the host reads it.
+ *
+ * Host side: the usbtmc_sim_*() functions from usbtmc_sim.h.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "tusb.h"
+#include "device/usbd_pvt.h"
+#include "bsp/board.h"
+#include "usbtmc_sim.h"
+
+#include "usb/usbtmc_app.h"
+#include "usb/usbtmc_sched.h"
+#include "usb/usb_utils.h"
+
+typedef enum {
+  STATE_CLOSED,
+  STATE_IDLE,
+  STATE_RCV,
+  STATE_NAK,
+  STATE_TX_REQUESTED,
+  STATE_TX_INITIATED,
+} sim_state_t;
+
+typedef struct sim_packet {
+  struct sim_packet *next;
+  size_t len;
+  uint8_t data[USBTMC_SIM_PACKET_SIZE];
+} sim_packet_t;
+
+static struct {
+  sim_state_t state;
+  bool out_armed;
+  uint32_t transfer_size_remaining;
+  bool term_char_requested;
+
+  // Bulk-IN transfer handed over by the application, completes in tud_task()
+  bool in_pending;
+  const uint8_t *in_data;
+  size_t in_len;
+  bool in_eom;
+  bool in_term_char;
+
+  // interrupt IN endpoint
+  bool int_busy;
+  uint8_t int_msg[2];
+
+#if CFG_TUD_VENDOR
+  // vendor bulk IN endpoint: TX FIFO, free running counters
+  uint8_t stream_fifo[CFG_TUD_VENDOR_TX_BUFSIZE];
+  uint32_t stream_head;
+  uint32_t stream_tail;
+#endif
+} dev;
+
+static struct {
+  sim_packet_t *out_head;
+  sim_packet_t *out_tail;
+  // packets are recycled: after warming up, the simulation doesn't allocate
+  sim_packet_t *free_packets;
+  uint8_t bTag;
+
+  // read in progress, VISA style: keeps requesting Bulk-IN transfers until EOM
+  struct {
+    bool active;
+    bool single;      // stop after one transfer
+    bool requested;   // REQUEST_DEV_DEP_MSG_IN sent, transfer not complete yet
+    uint8_t *buf;
+    size_t max;
+    size_t len;
+    bool eom;
+    bool term_char_enabled;
+    uint8_t term_char;
+  } reader;
+  uint32_t transfer_size;
+  // VISA's termination character: queries read until it, or until EOM
+  bool term_char_enabled;
+  uint8_t term_char;
+
+  bool int_ready;
+  uint8_t int_msg[2];
+
+  void (*loop)(void);
+  usbtmc_sim_stats_t stats;
+
+  // what the script line before got back, for !exp
+  const char *last_reply;
+  size_t last_reply_len;
+  uint32_t expect_failures;
+} host;
+
+static void packet_free(sim_packet_t *pkt) {
+  pkt->next = host.free_packets;
+  host.free_packets = pkt;
+}
+
+//--------------------------------------------------------------------+
+// device side: TinyUSB API
+//--------------------------------------------------------------------+
+
+bool tud_mounted(void) {
+  return dev.state != STATE_CLOSED;
+}
+
+bool tud_usbtmc_start_bus_read(void) {
+  switch (dev.state) {
+  // These may transition to IDLE
+  case STATE_NAK:
+    dev.state = STATE_IDLE;
+    break;
+  // When receiving, let it remain receiving
+  case STATE_RCV:
+    break;
+  default:
+    return false;
+  }
+  TU_VERIFY(!dev.out_armed);
+  dev.out_armed = true;
+  return true;
+}
+
+bool tud_usbtmc_transmit_dev_msg_data(const void * data, size_t len,
+    bool endOfMessage, bool usingTermChar) {
+  TU_VERIFY(dev.state == STATE_TX_REQUESTED);
+  TU_VERIFY(len <= dev.transfer_size_remaining);
+  TU_VERIFY(!usingTermChar || dev.term_char_requested);
+  dev.state = STATE_TX_INITIATED;
+  dev.in_pending = true;
+  dev.in_data = (const uint8_t *) data;
+  dev.in_len = len;
+  dev.in_eom = endOfMessage;
+  dev.in_term_char = usingTermChar;
+  return true;
+}
+
+bool usbd_edpt_busy(uint8_t rhport, uint8_t ep_addr) {
+  (void) rhport;
+  (void) ep_addr;
+  return dev.int_busy;
+}
+
+bool usbd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t * buffer, uint16_t total_bytes) {
+  (void) rhport;
+  (void) ep_addr;
+  TU_VERIFY(!dev.int_busy);
+  TU_VERIFY(total_bytes == sizeof(dev.int_msg));
+  // the hardware reads the buffer when the host polls, not now
+  memcpy(dev.int_msg, buffer, sizeof(dev.int_msg));
+  dev.int_busy = true;
+  return true;
+}
+
+#if CFG_TUD_VENDOR
+bool tud_vendor_mounted(void) {
+  return dev.state != STATE_CLOSED;
+}
+
+uint32_t tud_vendor_write_available(void) {
+  return CFG_TUD_VENDOR_TX_BUFSIZE - (dev.stream_head - dev.stream_tail);
+}
+
+uint32_t tud_vendor_write(void const* buffer, uint32_t bufsize) {
+  uint32_t len = tu_min32(bufsize, tud_vendor_write_available());
+  for (uint32_t i = 0; i < len; i++) {
+    dev.stream_fifo[dev.stream_head++ % CFG_TUD_VENDOR_TX_BUFSIZE] = ((const uint8_t *) buffer)[i];
+  }
+  return len;
+}
+
+uint32_t tud_vendor_write_flush(void) {
+  return dev.stream_head - dev.stream_tail;
+}
+#endif
+
+static void stall(void) {
+  host.stats.stalls++;
+  dev.state = STATE_NAK;
+  dev.out_armed = false;
+}
+
+static bool handle_dev_msg_out(const uint8_t *data, size_t len, size_t packet_len) {
+  bool short_packet = packet_len < USBTMC_SIM_PACKET_SIZE;
+  bool at_end = false;
+  if ((len >= dev.transfer_size_remaining) || short_packet) {
+    at_end = true;
+    dev.state = STATE_NAK;
+  }
+  len = tu_min32(len, dev.transfer_size_remaining);
+  dev.transfer_size_remaining -= len;
+  return tud_usbtmc_msg_data_cb((void *) data, len, at_end);
+}
+
+static void handle_out_packet(sim_packet_t *pkt) {
+  if (dev.state == STATE_RCV) {
+    if (!handle_dev_msg_out(pkt->data, pkt->len, pkt->len)) {
+      stall();
+    }
+    return;
+  }
+  if ((dev.state != STATE_IDLE) || (pkt->len < sizeof(usbtmc_msg_generic_t))) {
+    stall();
+    return;
+  }
+
+  usbtmc_msg_generic_t const *msg = (usbtmc_msg_generic_t const *) pkt->data;
+  switch (msg->header.MsgID) {
+  case USBTMC_MSGID_DEV_DEP_MSG_OUT: {
+    usbtmc_msg_request_dev_dep_out const *req = (usbtmc_msg_request_dev_dep_out const *) pkt->data;
+    if (!tud_usbtmc_msgBulkOut_start_cb(req)) {
+      stall();
+      return;
+    }
+    dev.state = STATE_RCV;
+    dev.transfer_size_remaining = req->TransferSize;
+    if (!handle_dev_msg_out(pkt->data + sizeof(*req), pkt->len - sizeof(*req), pkt->len)) {
+      stall();
+    }
+    break;
+  }
+  case USBTMC_MSGID_DEV_DEP_MSG_IN: {
+    usbtmc_msg_request_dev_dep_in const *req = (usbtmc_msg_request_dev_dep_in const *) pkt->data;
+    dev.state = STATE_TX_REQUESTED;
+    dev.transfer_size_remaining = req->TransferSize;
+    dev.term_char_requested = req->bmTransferAttributes.TermCharEnabled;
+    if (dev.term_char_requested &&
+        !tud_usbtmc_get_capabilities_cb()->bmDevCapabilities.canEndBulkInOnTermChar) {
+      stall();
+      return;
+    }
+    if (!tud_usbtmc_msgBulkIn_request_cb(req)) {
+      stall();
+    }
+    break;
+  }
+#if (CFG_TUD_USBTMC_ENABLE_488)
+  case USBTMC_MSGID_USB488_TRIGGER:
+    // like the real driver, the endpoint stays NAKed until the application re-arms it
+    dev.state = STATE_NAK;
+    if (!tud_usbtmc_msg_trigger_cb((usbtmc_msg_generic_t *) msg)) {
+      stall();
+    }
+    break;
+#endif
+  default:
+    stall();
+    break;
+  }
+}
+
+static void queue_packet(const uint8_t *data, size_t len);
+static void fill_header(usbtmc_msg_header_t *header, uint8_t msg_id);
+
+// the host side of tud_task(): issue the next Bulk-IN request of a read
+static void host_task(void) {
+  if (!host.reader.active || host.reader.requested || (host.out_head != NULL)) {
+    return;
+  }
+  size_t room = host.reader.max - host.reader.len;
+  if (!room) {
+    host.reader.active = false;
+    return;
+  }
+  usbtmc_msg_request_dev_dep_in req;
+  memset(&req, 0, sizeof(req));
+  fill_header(&req.header, USBTMC_MSGID_DEV_DEP_MSG_IN);
+  req.TransferSize = (host.transfer_size && (host.transfer_size < room)) ?
+      host.transfer_size : (uint32_t) room;
+  req.bmTransferAttributes.TermCharEnabled = host.reader.term_char_enabled ? 1 : 0;
+  req.TermChar = host.reader.term_char;
+  queue_packet((const uint8_t *) &req, sizeof(req));
+  host.reader.requested = true;
+}
+
+bool tud_task_event_ready(void) {
+  return dev.in_pending || (dev.out_armed && (host.out_head != NULL)) || (dev.int_busy && !host.int_ready);
+}
+
+void tud_task(void) {
+  // Bulk-IN transfer complete
+  if (dev.in_pending) {
+    dev.in_pending = false;
+    size_t len = tu_min32(dev.in_len, host.reader.max - host.reader.len);
+    if (host.reader.buf != NULL) {
+      memcpy(host.reader.buf + host.reader.len, dev.in_data, len);
+    }
+    host.reader.len += len;
+    host.reader.eom = dev.in_eom;
+    host.reader.requested = false;
+    if (dev.in_eom || host.reader.single || dev.in_term_char) {
+      host.reader.active = false;
+    }
+    host.stats.in_transfers++;
+    host.stats.in_bytes += len;
+    dev.state = STATE_NAK;
+    tud_usbtmc_msgBulkIn_complete_cb();
+  }
+
+  // Bulk-OUT packet received
+  if (dev.out_armed && (host.out_head != NULL)) {
+    sim_packet_t *pkt = host.out_head;
+    host.out_head = pkt->next;
+    if (host.out_head == NULL) {
+      host.out_tail = NULL;
+    }
+    dev.out_armed = false;
+    host.stats.out_packets++;
+    host.stats.out_bytes += pkt->len;
+    handle_out_packet(pkt);
+    packet_free(pkt);
+  }
+
+  // interrupt IN polled by the host
+  if (dev.int_busy && !host.int_ready) {
+    memcpy(host.int_msg, dev.int_msg, sizeof(host.int_msg));
+    host.int_ready = true;
+    dev.int_busy = false;
+  }
+
+  host_task();
+}
+
+//--------------------------------------------------------------------+
+// host side
+//--------------------------------------------------------------------+
+
+void usbtmc_sim_device_loop(void) {
+  usbtmc_sched_run();
+}
+
+void usbtmc_sim_set_device_loop(void (*loop)(void)) {
+  host.loop = loop;
+}
+
+void usbtmc_sim_poll(void) {
+  if (host.loop != NULL) {
+    host.loop();
+  } else {
+    usbtmc_sim_device_loop();
+  }
+}
+
+// a wait times out after this many polls, and at least USBTMC_SIM_READ_TIMEOUT_MS
+// (the SCPI engine can run on its own thread)
+static bool sim_waiting(uint32_t polls, uint32_t start) {
+  return (polls < USBTMC_SIM_READ_TIMEOUT_POLLS) || ((board_millis() - start) < USBTMC_SIM_READ_TIMEOUT_MS);
+}
+
+void usbtmc_sim_connect(void) {
+  memset(&dev, 0, sizeof(dev));
+  dev.state = STATE_NAK;
+  usbtmc_sched_init(); // the firmware's main() does this before its loop
+  tud_mount_cb();
+  tud_usbtmc_open_cb(0);
+}
+
+static void queue_packet(const uint8_t *data, size_t len) {
+  sim_packet_t *pkt = host.free_packets;
+  if (pkt != NULL) {
+    host.free_packets = pkt->next;
+    pkt->next = NULL;
+  } else {
+    pkt = calloc(1, sizeof(sim_packet_t));
+    if (pkt == NULL) {
+      abort();
+    }
+  }
+  memcpy(pkt->data, data, len);
+  pkt->len = len;
+  if (host.out_tail == NULL) {
+    host.out_head = pkt;
+  } else {
+    host.out_tail->next = pkt;
+  }
+  host.out_tail = pkt;
+}
+
+static uint8_t next_tag(void) {
+  host.bTag++;
+  if (host.bTag == 0) {
+    host.bTag = 1;
+  }
+  return host.bTag;
+}
+
+static void fill_header(usbtmc_msg_header_t *header, uint8_t msg_id) {
+  header->MsgID = msg_id;
+  header->bTag = next_tag();
+  header->bTagInverse = (uint8_t) ~header->bTag;
+  header->_reserved = 0;
+}
+
+void usbtmc_sim_post_write(const void *data, size_t len, bool eom) {
+  uint8_t packet[USBTMC_SIM_PACKET_SIZE];
+  usbtmc_msg_request_dev_dep_out req;
+  memset(&req, 0, sizeof(req));
+  fill_header(&req.header, USBTMC_MSGID_DEV_DEP_MSG_OUT);
+  req.TransferSize = (uint32_t) len;
+  req.bmTransferAttributes.EOM = eom ? 1 : 0;
+
+  // header + payload, padded to a multiple of 4 bytes (USBTMC 3.2)
+  size_t total = sizeof(req) + ((len + 3u) & ~3u);
+  const uint8_t *src = (const uint8_t *) data;
+  size_t ix = 0; // index in the transfer
+  while (ix < total) {
+    size_t pkt_len = tu_min32((uint32_t) (total - ix), USBTMC_SIM_PACKET_SIZE);
+    for (size_t i = 0; i < pkt_len; i++, ix++) {
+      if (ix < sizeof(req)) {
+        packet[i] = ((uint8_t *) &req)[ix];
+      } else if (ix - sizeof(req) < len) {
+        packet[i] = src[ix - sizeof(req)];
+      } else {
+        packet[i] = 0; // alignment
+      }
+    }
+    queue_packet(packet, pkt_len);
+  }
+  // no zero length packet after a transfer that's a multiple of the packet size: the device
+  // ends it at TransferSize, and takes the next packet for a new header
+}
+
+bool usbtmc_sim_write(const void *data, size_t len, bool eom) {
+  usbtmc_sim_post_write(data, len, eom);
+  // wait until the device has taken all packets
+  uint32_t start = board_millis();
+  for (uint32_t i = 0; (host.out_head != NULL) && sim_waiting(i, start); i++) {
+    usbtmc_sim_poll();
+  }
+  return host.out_head == NULL;
+}
+
+static void start_read(void *data, size_t max, bool single,
+    bool term_char_enabled, uint8_t term_char) {
+  memset(&host.reader, 0, sizeof(host.reader));
+  host.reader.active = true;
+  host.reader.single = single;
+  host.reader.buf = (uint8_t *) data;
+  host.reader.max = max;
+  host.reader.term_char_enabled = term_char_enabled;
+  host.reader.term_char = term_char;
+}
+
+// wait for the read to finish. On timeout, abort the Bulk-IN transfer like VISA does
+static size_t finish_read(bool *eom) {
+  uint32_t start = board_millis();
+  for (uint32_t i = 0; host.reader.active && sim_waiting(i, start); i++) {
+    usbtmc_sim_poll();
+  }
+  if (host.reader.active) {
+    uint8_t tmcResult;
+    usbtmc_check_abort_bulk_rsp_t rsp;
+    if (host.reader.requested) {
+      tud_usbtmc_initiate_abort_bulk_in_cb(&tmcResult);
+      dev.state = STATE_NAK;
+      dev.in_pending = false;
+      tud_usbtmc_check_abort_bulk_in_cb(&rsp);
+    }
+    host.reader.active = false;
+  }
+  if (eom != NULL) {
+    *eom = host.reader.eom;
+  }
+  host.reader.buf = NULL;
+  return host.reader.len;
+}
+
+void usbtmc_sim_set_transfer_size(uint32_t transfer_size) {
+  host.transfer_size = transfer_size;
+}
+
+void usbtmc_sim_set_term_char(bool enabled, uint8_t term_char) {
+  host.term_char_enabled = enabled;
+  host.term_char = term_char;
+}
+
+size_t usbtmc_sim_read(void *data, size_t transfer_size, bool *eom) {
+  start_read(data, transfer_size, true, false, 0);
+  return finish_read(eom);
+}
+
+size_t usbtmc_sim_read_termchar(void *data, size_t transfer_size, uint8_t term_char, bool *eom) {
+  start_read(data, transfer_size, true, true, term_char);
+  return finish_read(eom);
+}
+
+size_t usbtmc_sim_stream_read(void *data, size_t max) {
+  size_t len = 0u;
+#if CFG_TUD_VENDOR
+  uint32_t start = board_millis();
+  for (uint32_t i = 0; (len < max) && sim_waiting(i, start); i++) {
+    if (dev.stream_tail == dev.stream_head) {
+      usbtmc_sim_poll();
+      continue;
+    }
+    ((uint8_t *) data)[len++] = dev.stream_fifo[dev.stream_tail++ % CFG_TUD_VENDOR_TX_BUFSIZE];
+  }
+  host.stats.stream_bytes += len;
+#else
+  (void) data;
+  (void) max;
+#endif
+  return len;
+}
+
+size_t usbtmc_sim_query(const char *cmd, char *reply, size_t max) {
+  // the read is posted first, it starts when the write is out. The device may
+  // need it to make room for a long reply before it has executed the whole message.
+  start_read(reply, max, false, host.term_char_enabled, host.term_char);
+  if (!usbtmc_sim_write(cmd, strlen(cmd), true)) {
+    host.reader.active = false;
+    return 0;
+  }
+  return finish_read(NULL);
+}
+
+bool usbtmc_sim_trigger(void) {
+  usbtmc_msg_generic_t msg;
+  memset(&msg, 0, sizeof(msg));
+  fill_header(&msg.header, USBTMC_MSGID_USB488_TRIGGER);
+  queue_packet((const uint8_t *) &msg, sizeof(msg));
+  uint32_t start = board_millis();
+  for (uint32_t i = 0; (host.out_head != NULL) && sim_waiting(i, start); i++) {
+    usbtmc_sim_poll();
+  }
+  return host.out_head == NULL;
+}
+
+uint8_t usbtmc_sim_read_stb(void) {
+  uint8_t tmcResult;
+  return tud_usbtmc_get_stb_cb(&tmcResult);
+}
+
+bool usbtmc_sim_clear(void) {
+  uint8_t tmcResult;
+  usbtmc_get_clear_status_rsp_t rsp;
+  TU_VERIFY(tud_usbtmc_initiate_clear_cb(&tmcResult));
+  TU_VERIFY(tmcResult == USBTMC_STATUS_SUCCESS);
+  // the driver flushes both bulk endpoints
+  while (host.out_head != NULL) {
+    sim_packet_t *pkt = host.out_head;
+    host.out_head = pkt->next;
+    packet_free(pkt);
+  }
+  host.out_tail = NULL;
+  host.reader.active = false;
+  host.reader.requested = false;
+  dev.in_pending = false;
+  TU_VERIFY(tud_usbtmc_check_clear_cb(&rsp));
+  dev.state = STATE_IDLE;
+  dev.out_armed = true;
+  return rsp.USBTMC_status == USBTMC_STATUS_SUCCESS;
+}
+
+bool usbtmc_sim_indicator_pulse(void) {
+  uint8_t tmcResult;
+  tusb_control_request_t req;
+  memset(&req, 0, sizeof(req));
+  return tud_usbtmc_indicator_pulse_cb(&req, &tmcResult) &&
+      (tmcResult == USBTMC_STATUS_SUCCESS);
+}
+
+bool usbtmc_sim_poll_interrupt(uint8_t *bNotify1, uint8_t *status_byte) {
+  usbtmc_sim_poll();
+  if (!host.int_ready) {
+    return false;
+  }
+  *bNotify1 = host.int_msg[0];
+  *status_byte = host.int_msg[1];
+  host.int_ready = false;
+  return true;
+}
+
+// text matches pattern, where * stands for any run of characters (also none) on one line
+static bool script_match(const char *pattern, size_t pattern_len, const char *text, size_t text_len) {
+  size_t p = 0u;
+  size_t t = 0u;
+  size_t star = SIZE_MAX; // the last * in the pattern, and where the text was then
+  size_t star_text = 0u;
+  while (t < text_len) {
+    if ((p < pattern_len) && (pattern[p] == '*')) {
+      star = p++;
+      star_text = t;
+    } else if ((p < pattern_len) && (pattern[p] == text[t])) {
+      p++;
+      t++;
+    } else if ((star != SIZE_MAX) && (text[star_text] != '\n')) { // let the last * take one more character
+      p = star + 1u;
+      t = ++star_text;
+    } else {
+      return false;
+    }
+  }
+  while ((p < pattern_len) && (pattern[p] == '*')) {
+    p++;
+  }
+  return p == pattern_len;
+}
+
+// !exp: the line before got back this text (without its newline). !nexp: it didn't
+static void script_expect(const char *expected, bool match) {
+  size_t len = strcspn(expected, "\r\n");
+  const char *reply = (host.last_reply != NULL) ? host.last_reply : "";
+  size_t reply_len = host.last_reply_len;
+  if (reply_len && (reply[reply_len - 1u] == '\n')) {
+    reply_len--;
+  }
+  if (script_match(expected, len, reply, reply_len) != match) {
+    fprintf(stderr, "expected %s%.*s, got %.*s\n", match ? "" : "not ", (int) len, expected, (int) reply_len, reply);
+    host.expect_failures++;
+  }
+}
+
+static size_t script_line(const char *line, char *reply, size_t max) {
+  if (line[0] == '!') {
+    int len = 0;
+    if (!strncmp(line, "!trg", 4)) {
+      usbtmc_sim_trigger();
+    } else if (!strncmp(line, "!stb", 4)) {
+      len = snprintf(reply, max, "STB 0x%02x\n", usbtmc_sim_read_stb());
+    } else if (!strncmp(line, "!clr", 4)) {
+      usbtmc_sim_clear();
+    } else if (!strncmp(line, "!str", 4)) {
+      // read the stream, the reply shows the first and the last sample
+      int16_t samples[256];
+      size_t count = usbtmc_sim_stream_read(samples, tu_min32((uint32_t) atoi(line + 4), 256u) * sizeof(int16_t));
+      count /= sizeof(int16_t);
+      len = snprintf(reply, max, "STR %u %d %d\n", (unsigned) count,
+          count ? samples[0] : 0, count ? samples[count - 1u] : 0);
+    } else if (!strncmp(line, "!tc", 3)) {
+      int term_char = atoi(line + 3);
+      usbtmc_sim_set_term_char(term_char > 0, (uint8_t) term_char);
+    } else if (!strncmp(line, "!rd", 3)) {
+      // the rest of a reply that ended at the TermChar
+      start_read(reply, max, false, host.term_char_enabled, host.term_char);
+      len = (int) finish_read(NULL);
+      if ((len == 0) || (reply[len - 1] != '\n')) {
+        if ((size_t) len < max) {
+          reply[len++] = '\n';
+        }
+      }
+    } else if (!strncmp(line, "!idle", 5)) {
+      // no traffic for a while: the device loop keeps running
+      uint32_t start = board_millis();
+      uint32_t ms = (uint32_t) atoi(line + 5);
+      while ((board_millis() - start) < ms) {
+        usbtmc_sim_poll();
+      }
+    } else if (!strncmp(line, "!int", 4)) {
+      uint8_t notify, stb;
+      if (usbtmc_sim_poll_interrupt(&notify, &stb)) {
+        len = snprintf(reply, max, "INT 0x%02x 0x%02x\n", notify, stb);
+      }
+    }
+    return (len > 0) ? tu_min32((uint32_t) len, max) : 0u;
+  }
+
+  size_t len = strlen(line);
+  if (strchr(line, '?') == NULL) {
+    usbtmc_sim_write(line, len, true);
+    return 0u;
+  }
+  size_t reply_len = usbtmc_sim_query(line, reply, max);
+  if ((reply_len == 0u) || (reply[reply_len - 1u] != '\n')) {
+    if (reply_len < max) {
+      reply[reply_len++] = '\n'; // no reply (timeout), or one that doesn't end in a newline
+    }
+  }
+  return reply_len;
+}
+
+size_t usbtmc_sim_script_line(const char *line, char *reply, size_t max) {
+  if (!strncmp(line, "!exp", 4)) {
+    script_expect(line + 4 + strspn(line + 4, " "), true);
+    return 0u;
+  }
+  if (!strncmp(line, "!nexp", 5)) {
+    script_expect(line + 5 + strspn(line + 5, " "), false);
+    return 0u;
+  }
+  host.last_reply = reply;
+  host.last_reply_len = script_line(line, reply, max);
+  return host.last_reply_len;
+}
+
+uint32_t usbtmc_sim_expect_failures(void) {
+  return host.expect_failures;
+}
+
+usbtmc_sim_stats_t const * usbtmc_sim_get_stats(void) {
+  return &host.stats;
+}
+
+void usbtmc_sim_reset_stats(void) {
+  memset(&host.stats, 0, sizeof(host.stats));
+}
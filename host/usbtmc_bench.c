@@ -0,0 +1,359 @@
+/*
+ * usbtmc_bench.c - replay benchmark for the host simulation build
+ *
+ * Replays traffic scripts (one program message or USBTMC request per line,
+ * see usbtmc_sim_script_line()) through the USBTMC callbacks, the SCPI engine
+ * and the reply path. Per script it reports the time per message, the
+ * bulk throughput and the heap allocations, and compares them with a baseline:
+ *   ratio:       ns/message divided by the ns of a calibration loop, measured in the
+ *                same run. Fails when it's more than the tolerance above the baseline
+ *   bytes/pass:  Bulk-OUT + Bulk-IN bytes of one pass. Fails on any change,
+ *                the traffic itself is deterministic
+ *   allocs/pass: fails when it goes up
+ *   !exp lines:  fail when the reply before isn't what the script expects
+ *
+ * usage: usbtmc_bench [-b baseline] [-u] [-t tolerance] [script...]
+ *   no scripts: the ones in host/bench
+ *   -b: baseline file, default host/bench/baseline.txt (baseline_dual.txt with PSL_DUAL_CORE)
+ *   -u: write the results to the baseline file instead of comparing
+ *   -t: allowed growth of the ratio, default 1.5
+ * The calibration loop doesn't run any library code, so the ratios hold from one machine to the
+ * next. A change that moves them records the baseline again with -u, in the same commit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tusb.h"
+#include "usbtmc_sim.h"
+#include "scpi/scpi_base.h"
+
+#define LINE_MAX_LEN 4096u
+#define REPLY_MAX_LEN (1024u * 1024u)
+#define SCRIPTS_MAX 32u
+// a round replays the script for at least this long. The result is the fastest round:
+// on a busy machine, that's the one with the least interference
+#define ROUND_MIN_NS 20000000u
+#define ROUNDS 7u
+// calibration: formats, parses and hashes a short header, the kind of work the SCPI engine does
+#define CALIBRATION_UNITS 4096u
+
+#if USBTMC_APP_DUAL_CORE
+#define BASELINE_FILE "/baseline_dual.txt"
+#else
+#define BASELINE_FILE "/baseline.txt"
+#endif
+
+static const char *default_scripts[] = {
+  USBTMC_BENCH_DIR "/idn_storm.txt",
+  USBTMC_BENCH_DIR "/chained_setup.txt",
+  USBTMC_BENCH_DIR "/bulk_query.txt",
+  USBTMC_BENCH_DIR "/macro_setup.txt",
+  USBTMC_BENCH_DIR "/dispatch_cache.txt",
+};
+
+// heap allocations. The executable is linked with --wrap for malloc, calloc and realloc
+#if USBTMC_BENCH_COUNT_ALLOCS
+static unsigned long allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  allocs++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  allocs++;
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  allocs++;
+  return __real_realloc(ptr, size);
+}
+#else
+static const unsigned long allocs = 0u;
+#endif
+
+typedef struct {
+  char name[64];
+  double ns_per_message;
+  double ratio;         // ns_per_message / ns per calibration unit
+  double bytes_per_second;
+  unsigned long long bytes_per_pass;
+  unsigned long allocs_per_pass;
+} bench_result_t;
+
+typedef struct {
+  char **lines;
+  size_t count;
+} script_t;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000u) + (uint64_t) ts.tv_nsec;
+}
+
+static volatile uint32_t calibration_sink;
+
+static void calibration_pass(void) {
+  char text[32];
+  uint32_t hash = calibration_sink;
+  for (uint32_t i = 0u; i < CALIBRATION_UNITS; i++) {
+    int len = snprintf(text, sizeof(text), "SOUR%u:VOLT %u.%03u", i & 3u, i, hash & 0x3FFu);
+    char *end;
+    hash += (uint32_t) strtoul(&text[12], &end, 10);
+    for (int c = 0; c < len; c++) {
+      hash = (hash ^ (uint8_t) text[c]) * 16777619u; // FNV-1a
+    }
+  }
+  calibration_sink = hash;
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+// ns per calibration unit of one round
+static double calibration_round(unsigned long passes) {
+  uint64_t start = now_ns();
+  for (unsigned long p = 0u; p < passes; p++) {
+    calibration_pass();
+  }
+  return (double) (now_ns() - start) / (double) (passes * CALIBRATION_UNITS);
+}
+
+// calibration passes in a round of ROUND_MIN_NS
+static unsigned long calibration_passes(void) {
+  uint64_t start = now_ns();
+  calibration_pass();
+  uint64_t once = now_ns() - start;
+  return (once < ROUND_MIN_NS) ? (unsigned long) (ROUND_MIN_NS / (once ? once : 1u)) + 1u : 1u;
+}
+
+static bool script_load(const char *path, script_t *script) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return false;
+  }
+  char line[LINE_MAX_LEN];
+  script->lines = NULL;
+  script->count = 0u;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    script->lines = realloc(script->lines, (script->count + 1u) * sizeof(char *));
+    script->lines[script->count++] = strdup(line);
+  }
+  fclose(f);
+  return script->count > 0u;
+}
+
+static void script_free(script_t *script) {
+  for (size_t i = 0u; i < script->count; i++) {
+    free(script->lines[i]);
+  }
+  free(script->lines);
+}
+
+static void script_pass(const script_t *script, char *reply) {
+  for (size_t i = 0u; i < script->count; i++) {
+    usbtmc_sim_script_line(script->lines[i], reply, REPLY_MAX_LEN);
+  }
+}
+
+static unsigned long long sim_bytes(void) {
+  usbtmc_sim_stats_t const *stats = usbtmc_sim_get_stats();
+  return (unsigned long long) (stats->out_bytes + stats->in_bytes);
+}
+
+static void script_name(const char *path, char *name, size_t max) {
+  const char *base = strrchr(path, '/');
+  base = (base != NULL) ? base + 1 : path;
+  snprintf(name, max, "%s", base);
+  char *dot = strrchr(name, '.');
+  if (dot != NULL) {
+    *dot = '\0';
+  }
+}
+
+// each round of the script comes right after a round of the calibration loop: both see the same
+// machine, the ratio of their fastest rounds is what's compared
+static void bench_script(const script_t *script, char *reply, bench_result_t *result) {
+  unsigned long calibration_count = calibration_passes();
+  // warm up: first pass allocates what the simulation recycles later, and gives the traffic volume
+  usbtmc_sim_reset_stats();
+  script_pass(script, reply);
+  result->bytes_per_pass = sim_bytes();
+
+  uint64_t start = now_ns();
+  unsigned long passes = 1u;
+  script_pass(script, reply);
+  uint64_t once = now_ns() - start;
+  if (once < ROUND_MIN_NS) {
+    passes = (unsigned long) (ROUND_MIN_NS / (once ? once : 1u)) + 1u;
+  }
+
+  double ns[ROUNDS];
+  double calibration[ROUNDS];
+  double bytes_per_second[ROUNDS];
+  unsigned long allocs_start = allocs;
+  for (unsigned int r = 0u; r < ROUNDS; r++) {
+    calibration[r] = calibration_round(calibration_count);
+    usbtmc_sim_reset_stats();
+    start = now_ns();
+    for (unsigned long p = 0u; p < passes; p++) {
+      script_pass(script, reply);
+    }
+    uint64_t elapsed = now_ns() - start;
+    ns[r] = (double) elapsed / (double) (passes * script->count);
+    bytes_per_second[r] = (double) sim_bytes() * 1e9 / (double) elapsed;
+  }
+  qsort(ns, ROUNDS, sizeof(double), compare_double);
+  qsort(calibration, ROUNDS, sizeof(double), compare_double);
+  qsort(bytes_per_second, ROUNDS, sizeof(double), compare_double);
+  result->ns_per_message = ns[0];
+  result->ratio = ns[0] / calibration[0];
+  result->bytes_per_second = bytes_per_second[ROUNDS - 1u];
+  unsigned long measured = allocs - allocs_start;
+  unsigned long total_passes = passes * ROUNDS;
+  result->allocs_per_pass = (measured + total_passes - 1u) / total_passes;
+}
+
+static bool baseline_find(const char *path, const char *name, bench_result_t *baseline) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return false;
+  }
+  char line[256];
+  bool found = false;
+  while (!found && (fgets(line, sizeof(line), f) != NULL)) {
+    if (line[0] == '#') {
+      continue;
+    }
+    if ((sscanf(line, "%63s %lf %llu %lu", baseline->name, &baseline->ratio,
+        &baseline->bytes_per_pass, &baseline->allocs_per_pass) == 4) && !strcmp(baseline->name, name)) {
+      found = true;
+    }
+  }
+  fclose(f);
+  return found;
+}
+
+static bool baseline_write(const char *path, const bench_result_t *results, size_t count) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    return false;
+  }
+  fprintf(f, "# usbtmc_bench baseline: script ratio (ns/message per calibration ns) bytes/pass allocs/pass\n");
+  for (size_t i = 0u; i < count; i++) {
+    fprintf(f, "%s %.1f %llu %lu\n", results[i].name, results[i].ratio,
+        results[i].bytes_per_pass, results[i].allocs_per_pass);
+  }
+  fclose(f);
+  return true;
+}
+
+static bool baseline_check(const bench_result_t *result, const bench_result_t *baseline, double tolerance) {
+  bool ok = true;
+  if (result->ratio > baseline->ratio * tolerance) {
+    printf("  FAIL %s: ratio %.1f, baseline %.1f\n", result->name, result->ratio, baseline->ratio);
+    ok = false;
+  }
+  if (result->bytes_per_pass != baseline->bytes_per_pass) {
+    printf("  FAIL %s: %llu bytes/pass, baseline %llu\n", result->name, result->bytes_per_pass, baseline->bytes_per_pass);
+    ok = false;
+  }
+  if (result->allocs_per_pass > baseline->allocs_per_pass) {
+    printf("  FAIL %s: %lu allocs/pass, baseline %lu\n", result->name, result->allocs_per_pass, baseline->allocs_per_pass);
+    ok = false;
+  }
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  const char *baseline = USBTMC_BENCH_DIR BASELINE_FILE;
+  bool update = false;
+  double tolerance = 1.5;
+  const char *scripts[SCRIPTS_MAX];
+  size_t scripts_count = 0u;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-b") && (i + 1 < argc)) {
+      baseline = argv[++i];
+    } else if (!strcmp(argv[i], "-t") && (i + 1 < argc)) {
+      tolerance = strtod(argv[++i], NULL);
+    } else if (!strcmp(argv[i], "-u")) {
+      update = true;
+    } else if ((argv[i][0] != '-') && (scripts_count < SCRIPTS_MAX)) {
+      scripts[scripts_count++] = argv[i];
+    } else {
+      fprintf(stderr, "usage: %s [-b baseline] [-u] [-t tolerance] [script...]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (!scripts_count) {
+    for (size_t i = 0u; i < sizeof(default_scripts) / sizeof(default_scripts[0]); i++) {
+      scripts[scripts_count++] = default_scripts[i];
+    }
+  }
+
+  char *reply = malloc(REPLY_MAX_LEN);
+  if (reply == NULL) {
+    return 2;
+  }
+  scpi_instrument_init();
+#if USBTMC_APP_DUAL_CORE
+  usbtmc_app_start_executor();
+#endif
+  usbtmc_sim_connect();
+
+  bench_result_t results[SCRIPTS_MAX];
+  bool ok = true;
+  printf("%-20s %12s %8s %14s %12s %12s\n", "script", "ns/message", "ratio", "bytes/s", "bytes/pass", "allocs/pass");
+  for (size_t i = 0u; i < scripts_count; i++) {
+    script_t script;
+    if (!script_load(scripts[i], &script)) {
+      fprintf(stderr, "can't read %s\n", scripts[i]);
+      return 2;
+    }
+    bench_result_t *result = &results[i];
+    script_name(scripts[i], result->name, sizeof(result->name));
+    uint32_t failures = usbtmc_sim_expect_failures();
+    bench_script(&script, reply, result);
+    script_free(&script);
+    printf("%-20s %12.0f %8.1f %14.0f %12llu %12lu\n", result->name, result->ns_per_message, result->ratio,
+        result->bytes_per_second, result->bytes_per_pass, result->allocs_per_pass);
+    if (usbtmc_sim_expect_failures() != failures) {
+      printf("  %s: %u replies weren't as expected (!exp)\n", result->name,
+          (unsigned) (usbtmc_sim_expect_failures() - failures));
+      ok = false;
+    }
+
+    bench_result_t reference;
+    if (update) {
+      continue;
+    }
+    if (!baseline_find(baseline, result->name, &reference)) {
+      printf("  no baseline for %s\n", result->name);
+    } else if (!baseline_check(result, &reference, tolerance)) {
+      ok = false;
+    }
+  }
+  free(reply);
+
+  if (update) {
+    if (!baseline_write(baseline, results, scripts_count)) {
+      fprintf(stderr, "can't write %s\n", baseline);
+      return 2;
+    }
+    printf("baseline written to %s\n", baseline);
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+/*
+ * usbtmc_sim_main.c - console host for the simulated instrument
+ *
+ * Reads program messages from stdin or a script, one per line, sends them to the
+ * simulated device and prints the reply of queries.
+ * Lines starting with ! are USBTMC / USB488 requests instead of SCPI:
+ *   !trg  TRIGGER message
+ *   !stb  READ_STATUS_BYTE
+ *   !clr  INITIATE_CLEAR / CHECK_CLEAR_STATUS
+ *   !int  poll the interrupt IN endpoint
+ *   !idle <ms> no traffic for ms, the device keeps running
+ *   !exp  <text> the line before got back text, * matches any characters on one line.
+ *         Exits with 1 when one doesn't match
+ *   !nexp <text> the line before didn't get back text
+ *
+ * usage: usbtmc_sim [repeat] [script]
+ *   repeat: replay the script this many times and report the time per message
+ *   script: read the lines from this file instead of stdin (ctest runs host/check this way)
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tusb.h"
+#include "usbtmc_sim.h"
+#include "scpi/scpi_base.h"
+
+#define LINE_MAX_LEN 4096u
+#define REPLY_MAX_LEN (1024u * 1024u)
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000u) + (uint64_t) ts.tv_nsec;
+}
+
+static void run_line(const char *line, char *reply, bool echo) {
+  size_t reply_len = usbtmc_sim_script_line(line, reply, REPLY_MAX_LEN);
+  if (echo) {
+    fwrite(reply, 1, reply_len, stdout);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long repeat = 0;
+  FILE *script = stdin;
+  for (int i = 1; i < argc; i++) {
+    if (isdigit((unsigned char) argv[i][0])) {
+      repeat = strtoul(argv[i], NULL, 10);
+    } else if ((script = fopen(argv[i], "r")) == NULL) {
+      fprintf(stderr, "can't read %s\n", argv[i]);
+      return 2;
+    }
+  }
+  char *reply = malloc(REPLY_MAX_LEN);
+  if (reply == NULL) {
+    return 1;
+  }
+
+  scpi_instrument_init();
+#if USBTMC_APP_DUAL_CORE
+  usbtmc_app_start_executor();
+#endif
+  usbtmc_sim_connect();
+
+  // slurp the script, so that it can be replayed
+  size_t lines_count = 0;
+  char **lines = NULL;
+  char line[LINE_MAX_LEN];
+  while (fgets(line, sizeof(line), script) != NULL) {
+    lines = realloc(lines, (lines_count + 1) * sizeof(char *));
+    lines[lines_count++] = strdup(line);
+  }
+
+  if (!repeat) {
+    for (size_t i = 0; i < lines_count; i++) {
+      run_line(lines[i], reply, true);
+    }
+  } else {
+    uint64_t start = now_ns();
+    for (unsigned long r = 0; r < repeat; r++) {
+      for (size_t i = 0; i < lines_count; i++) {
+        run_line(lines[i], reply, false);
+      }
+    }
+    uint64_t elapsed = now_ns() - start;
+    unsigned long messages = repeat * lines_count;
+    usbtmc_sim_stats_t const *stats = usbtmc_sim_get_stats();
+    printf("%lu messages in %.3f ms, %.0f ns/message\n", messages,
+        (double) elapsed / 1e6, messages ? (double) elapsed / (double) messages : 0.0);
+    printf("out: %u packets %llu bytes, in: %u transfers %llu bytes, stalls: %u\n",
+        stats->out_packets, (unsigned long long) stats->out_bytes,
+        stats->in_transfers, (unsigned long long) stats->in_bytes, stats->stalls);
+  }
+
+  for (size_t i = 0; i < lines_count; i++) {
+    free(lines[i]);
+  }
+  free(lines);
+  free(reply);
+  if (script != stdin) {
+    fclose(script);
+  }
+  return usbtmc_sim_expect_failures() ? 1 : 0;
+}
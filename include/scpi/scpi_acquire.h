@@ -0,0 +1,70 @@
+#ifndef SCPI_SCPI_ACQUIRE_H
+#define SCPI_SCPI_ACQUIRE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "scpi/scpi.h"
+
+/*
+ * Continuous acquisition. The instrument's timer interrupt or DMA completion handler fills
+ * a ring buffer of 16 bit samples, FETCh:ARRay? drains it through the reply, in the format
+ * set with FORMat:DATA. The ring is lock-free, with one producer and one consumer (the SCPI
+ * engine), so the producer can run in an interrupt or on the other core.
+ *
+ * INITiate:CONTinuous ON calls the instrument's control function to start the producer,
+ * OFF to stop it. Samples that arrive while the ring is full are dropped and counted as overrun.
+ *
+ * With the vendor bulk interface (usb/usb_stream.h), STReam ON hands the consumer side to the
+ * USB stack: the samples go to the host as raw little endian int16, FETCh:ARRay? is refused.
+ *
+ * Built with the CMake option PSL_ACQUIRE, which defines SCPI_ACQUIRE.
+ */
+
+#ifndef SCPI_ACQUIRE
+#define SCPI_ACQUIRE 0
+#endif
+
+// samples in the ring buffer, a power of 2
+#ifndef SCPI_ACQUIRE_DEPTH
+#define SCPI_ACQUIRE_DEPTH 4096u
+#endif
+// FETCh:ARRay? gives the copied samples back to the producer in parts of this size
+#ifndef SCPI_ACQUIRE_FETCH_PART
+#define SCPI_ACQUIRE_FETCH_PART 256u
+#endif
+
+// start (run true) or stop the producer
+typedef void (*scpi_acquire_control_t)(bool run, void * context);
+
+void scpi_acquire_init(scpi_acquire_control_t control, void * context);
+// *RST: stop, drop the samples and clear the counters. False when the stream didn't let go of
+// the ring in time (see usb_stream_enable): the samples and counters stay
+bool scpi_acquire_reset();
+
+// producer side. Only while running, from one place at a time
+// contiguous free space at the head of the ring, e.g. the target of the next DMA transfer
+size_t scpi_acquire_space(int16_t ** data);
+// hand over count samples that were written to the space. count <= space
+void scpi_acquire_commit(size_t count);
+// copy samples into the ring. Returns how many fit, the rest counts as overrun
+size_t scpi_acquire_put(const int16_t * data, size_t count);
+// samples that didn't fit and were dropped
+void scpi_acquire_overrun(size_t count);
+
+// consumer side. The SCPI engine, or the stream while it's on
+// contiguous samples at the tail of the ring
+size_t scpi_acquire_peek(const int16_t ** data);
+// give count samples back to the producer. count <= peek
+void scpi_acquire_release(size_t count);
+
+scpi_result_t SCPI_InitiateContinuous(scpi_t * context);
+scpi_result_t SCPI_InitiateContinuousQ(scpi_t * context);
+scpi_result_t SCPI_FetchArrayQ(scpi_t * context);
+scpi_result_t SCPI_FetchArrayPointsQ(scpi_t * context);
+scpi_result_t SCPI_FetchArrayStatisticsQ(scpi_t * context);
+scpi_result_t SCPI_Stream(scpi_t * context);
+scpi_result_t SCPI_StreamQ(scpi_t * context);
+scpi_result_t SCPI_StreamStatisticsQ(scpi_t * context);
+
+#endif // SCPI_SCPI_ACQUIRE_H
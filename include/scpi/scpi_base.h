@@ -2,9 +2,87 @@
 #define SCPI_SCPI_BASE_H
 
 #include "scpi/scpi.h"
+#include "scpi/scpi_acquire.h"
+#include "scpi/scpi_format.h"
+#include "scpi/scpi_log.h"
+#include "scpi/scpi_macro.h"
+#include "scpi/scpi_memory.h"
+#include "scpi/scpi_operation.h"
+#include "scpi/scpi_perf.h"
+#include "scpi/scpi_sequence.h"
+#include "scpi/scpi_status.h"
+#include "scpi/scpi_trace.h"
+#include "scpi/scpi_trigger.h"
+#include "usb/usbtmc_app.h"
+#include "usb/usbtmc_sched.h"
 
+#ifndef SCPI_INPUT_BUFFER_LENGTH
 #define SCPI_INPUT_BUFFER_LENGTH 256
+#endif
+// longest header path that is carried over when a long message is executed in parts
+#define SCPI_STREAM_PATH_LENGTH 48
+#ifndef SCPI_ERROR_QUEUE_SIZE
 #define SCPI_ERROR_QUEUE_SIZE 17
+#endif
+
+// the commands of the optional subsystems, empty when they're not built
+#if SCPI_ACQUIRE
+#define SCPI_ACQUIRE_COMMANDS \
+    /* Continuous acquisition */ \
+    {.pattern = "INITiate:CONTinuous", .callback = SCPI_InitiateContinuous,}, \
+    {.pattern = "INITiate:CONTinuous?", .callback = SCPI_InitiateContinuousQ,}, \
+    {.pattern = "FETCh:ARRay?", .callback = SCPI_FetchArrayQ,}, \
+    {.pattern = "FETCh:ARRay:POINts?", .callback = SCPI_FetchArrayPointsQ,}, \
+    {.pattern = "FETCh:ARRay:STATistics?", .callback = SCPI_FetchArrayStatisticsQ,}, \
+    {.pattern = "STReam", .callback = SCPI_Stream,}, \
+    {.pattern = "STReam?", .callback = SCPI_StreamQ,}, \
+    {.pattern = "STReam:STATistics?", .callback = SCPI_StreamStatisticsQ,},
+#else
+#define SCPI_ACQUIRE_COMMANDS
+#endif
+// SCPI_SEQUENCE_COMMANDS is taken: it sizes the resolved steps
+#if SCPI_SEQUENCE
+#define SCPI_SEQUENCER_COMMANDS \
+    /* Sequence of timed steps, run by the device */ \
+    {.pattern = "SEQuence:CLEar", .callback = SCPI_SequenceClear,}, \
+    {.pattern = "SEQuence:STEP", .callback = SCPI_SequenceStep,}, \
+    {.pattern = "SEQuence:STEP:COUNt?", .callback = SCPI_SequenceStepCountQ,}, \
+    {.pattern = "SEQuence:COUNt", .callback = SCPI_SequenceCount,}, \
+    {.pattern = "SEQuence:COUNt?", .callback = SCPI_SequenceCountQ,}, \
+    {.pattern = "SEQuence:STARt", .callback = SCPI_SequenceStart,}, \
+    {.pattern = "SEQuence:ABORt", .callback = SCPI_SequenceAbort,}, \
+    {.pattern = "SEQuence:STATe?", .callback = SCPI_SequenceStateQ,}, \
+    {.pattern = "SEQuence:RESult?", .callback = SCPI_SequenceResultQ,},
+#else
+#define SCPI_SEQUENCER_COMMANDS
+#endif
+#if SCPI_MACRO
+#define SCPI_MACRO_COMMANDS \
+    /* IEEE 488.2 macros */ \
+    { .pattern = "*DMC", .callback = SCPI_CoreDmc,}, \
+    { .pattern = "*EMC", .callback = SCPI_CoreEmc,}, \
+    { .pattern = "*EMC?", .callback = SCPI_CoreEmcQ,}, \
+    { .pattern = "*GMC?", .callback = SCPI_CoreGmcQ,}, \
+    { .pattern = "*LMC?", .callback = SCPI_CoreLmcQ,}, \
+    { .pattern = "*PMC", .callback = SCPI_CorePmc,}, \
+    { .pattern = "*RMC", .callback = SCPI_CoreRmc,},
+#else
+#define SCPI_MACRO_COMMANDS
+#endif
+#if SCPI_TRACE
+#define SCPI_TRACE_COMMANDS \
+    /* Trace buffers (SCPI std V1999.0 20) */ \
+    {.pattern = "TRACe:DEFine", .callback = SCPI_TraceDefine,}, \
+    {.pattern = "TRACe:DELete", .callback = SCPI_TraceDelete,}, \
+    {.pattern = "TRACe:DELete:ALL", .callback = SCPI_TraceDeleteAll,}, \
+    {.pattern = "TRACe:CLEar", .callback = SCPI_TraceClear,}, \
+    {.pattern = "TRACe:CATalog?", .callback = SCPI_TraceCatalogQ,}, \
+    {.pattern = "TRACe:POINts?", .callback = SCPI_TracePointsQ,}, \
+    {.pattern = "TRACe:FREE?", .callback = SCPI_TraceFreeQ,}, \
+    {.pattern = "TRACe[:DATA]?", .callback = SCPI_TraceDataQ,},
+#else
+#define SCPI_TRACE_COMMANDS
+#endif
 
 #define SCPI_BASE_COMMANDS \
     /* IEEE Mandated Commands (SCPI std V1999.0 4.1.1) */ \
@@ -13,32 +91,78 @@
     { .pattern = "*ESE?", .callback = SCPI_CoreEseQ,}, \
     { .pattern = "*ESR?", .callback = SCPI_CoreEsrQ,}, \
     { .pattern = "*IDN?", .callback = SCPI_CoreIdnQ,}, \
-    { .pattern = "*OPC", .callback = SCPI_CoreOpc,}, \
-    { .pattern = "*OPC?", .callback = SCPI_CoreOpcQ,}, \
+    { .pattern = "*OPC", .callback = My_CoreOpc,}, \
+    { .pattern = "*OPC?", .callback = My_CoreOpcQ,}, \
     { .pattern = "*RST", .callback = SCPI_CoreRst,}, \
     { .pattern = "*SRE", .callback = SCPI_CoreSre,}, \
     { .pattern = "*SRE?", .callback = SCPI_CoreSreQ,}, \
     { .pattern = "*STB?", .callback = SCPI_CoreStbQ,}, \
     { .pattern = "*TST?", .callback = My_CoreTstQ,}, \
-    { .pattern = "*WAI", .callback = SCPI_CoreWai,}, \
+    { .pattern = "*WAI", .callback = My_CoreWai,}, \
+ \
+    SCPI_MACRO_COMMANDS \
  \
     /* Required SCPI commands (SCPI std V1999.0 4.2.1) */ \
     {.pattern = "SYSTem:ERRor[:NEXT]?", .callback = SCPI_SystemErrorNextQ,}, \
     {.pattern = "SYSTem:ERRor:COUNt?", .callback = SCPI_SystemErrorCountQ,}, \
     {.pattern = "SYSTem:VERSion?", .callback = SCPI_SystemVersionQ,}, \
+    {.pattern = "SYSTem:DISPatch:CACHe?", .callback = SCPI_SystemDispatchCacheQ,}, \
+    {.pattern = "SYSTem:DISPatch:CACHe:RESet", .callback = SCPI_SystemDispatchCacheReset,}, \
+    {.pattern = "SYSTem:PERFormance?", .callback = SCPI_SystemPerformanceQ,}, \
+    {.pattern = "SYSTem:PERFormance:HISTogram?", .callback = SCPI_SystemPerformanceHistogramQ,}, \
+    {.pattern = "SYSTem:PERFormance:RESet", .callback = SCPI_SystemPerformanceReset,}, \
+    {.pattern = "SYSTem:PERFormance:THRoughput?", .callback = SCPI_SystemPerformanceThroughputQ,}, \
+    {.pattern = "SYSTem:PERFormance:IDLE?", .callback = SCPI_SystemPerformanceIdleQ,}, \
+    {.pattern = "SYSTem:COMMunicate:USB:THRoughput", .callback = SCPI_SystemCommunicateUsbThroughput,}, \
+    {.pattern = "SYSTem:COMMunicate:USB:THRoughput?", .callback = SCPI_SystemCommunicateUsbThroughputQ,}, \
+    {.pattern = "SYSTem:IDLE", .callback = SCPI_SystemIdle,}, \
+    {.pattern = "SYSTem:IDLE?", .callback = SCPI_SystemIdleQ,}, \
+    {.pattern = "SYSTem:TASK?", .callback = SCPI_SystemTaskQ,}, \
+    {.pattern = "SYSTem:TASK:RESet", .callback = SCPI_SystemTaskReset,}, \
+    {.pattern = "SYSTem:MEMory?", .callback = SCPI_SystemMemoryQ,}, \
+    {.pattern = "SYSTem:MEMory:RESet", .callback = SCPI_SystemMemoryReset,}, \
+    {.pattern = "SYSTem:LOG?", .callback = SCPI_SystemLogQ,}, \
  \
  \
     {.pattern = "STATus:OPERation:EVENt?", .callback = SCPI_StatusOperationEventQ,}, \
-    {.pattern = "STATus:OPERation:CONDition?", .callback = SCPI_StatusOperationConditionQ,}, \
+    {.pattern = "STATus:OPERation:CONDition?", .callback = SCPI_StatusOperationCondQ,}, \
     {.pattern = "STATus:OPERation:ENABle", .callback = SCPI_StatusOperationEnable,}, \
     {.pattern = "STATus:OPERation:ENABle?", .callback = SCPI_StatusOperationEnableQ,}, \
+    {.pattern = "STATus:OPERation:PTRansition", .callback = SCPI_StatusOperationPtr,}, \
+    {.pattern = "STATus:OPERation:PTRansition?", .callback = SCPI_StatusOperationPtrQ,}, \
+    {.pattern = "STATus:OPERation:NTRansition", .callback = SCPI_StatusOperationNtr,}, \
+    {.pattern = "STATus:OPERation:NTRansition?", .callback = SCPI_StatusOperationNtrQ,}, \
  \
     {.pattern = "STATus:QUEStionable[:EVENt]?", .callback = SCPI_StatusQuestionableEventQ,}, \
-    {.pattern = "STATus:QUEStionable:CONDition?", .callback = SCPI_StatusQuestionableConditionQ,}, \
+    {.pattern = "STATus:QUEStionable:CONDition?", .callback = SCPI_StatusQuestionableCondQ,}, \
     {.pattern = "STATus:QUEStionable:ENABle", .callback = SCPI_StatusQuestionableEnable,}, \
     {.pattern = "STATus:QUEStionable:ENABle?", .callback = SCPI_StatusQuestionableEnableQ,}, \
+    {.pattern = "STATus:QUEStionable:PTRansition", .callback = SCPI_StatusQuestionablePtr,}, \
+    {.pattern = "STATus:QUEStionable:PTRansition?", .callback = SCPI_StatusQuestionablePtrQ,}, \
+    {.pattern = "STATus:QUEStionable:NTRansition", .callback = SCPI_StatusQuestionableNtr,}, \
+    {.pattern = "STATus:QUEStionable:NTRansition?", .callback = SCPI_StatusQuestionableNtrQ,}, \
+ \
+    {.pattern = "STATus:PRESet", .callback = SCPI_StatusPresetFilters,}, \
+ \
+    /* Data format (SCPI std V1999.0 9) */ \
+    {.pattern = "FORMat[:DATA]", .callback = SCPI_FormatData,}, \
+    {.pattern = "FORMat[:DATA]?", .callback = SCPI_FormatDataQ,}, \
+    {.pattern = "FORMat:BORDer", .callback = SCPI_FormatBorder,}, \
+    {.pattern = "FORMat:BORDer?", .callback = SCPI_FormatBorderQ,}, \
+ \
+    SCPI_TRACE_COMMANDS \
  \
-    {.pattern = "STATus:PRESet", .callback = SCPI_StatusPreset,}, \
+    /* Trigger system */ \
+    {.pattern = "INITiate[:IMMediate]", .callback = SCPI_Initiate,}, \
+    {.pattern = "ABORt", .callback = SCPI_Abort,}, \
+    {.pattern = "ARM[:SEQuence]:COUNt", .callback = SCPI_ArmCount,}, \
+    {.pattern = "ARM[:SEQuence]:COUNt?", .callback = SCPI_ArmCountQ,}, \
+    {.pattern = "TRIGger[:SEQuence]:SOURce", .callback = SCPI_TriggerSource,}, \
+    {.pattern = "TRIGger[:SEQuence]:SOURce?", .callback = SCPI_TriggerSourceQ,}, \
+    {.pattern = "TRIGger[:SEQuence]:TIMestamp?", .callback = SCPI_TriggerTimestampQ,}, \
+    {.pattern = "TRIGger[:SEQuence]:LATency?", .callback = SCPI_TriggerLatencyQ,}, \
+    SCPI_ACQUIRE_COMMANDS \
+    SCPI_SEQUENCER_COMMANDS \
     /* VISA commands */  \
     /* support VISA ASSERT TRIGGER */  \
     /* https://www.ni.com/docs/en-US/bundle/labview-api-ref/page/functions/visa-assert-trigger.html */  \
@@ -46,11 +170,30 @@
 
 
 scpi_result_t My_CoreTstQ(scpi_t * context);
-scpi_result_t SCPI_VisaTrg(scpi_t * context);
+scpi_result_t SCPI_SystemDispatchCacheQ(scpi_t * context);
+scpi_result_t SCPI_SystemDispatchCacheReset(scpi_t * context);
+scpi_result_t SCPI_SystemCommunicateUsbThroughput(scpi_t * context);
+scpi_result_t SCPI_SystemCommunicateUsbThroughputQ(scpi_t * context);
+scpi_result_t SCPI_SystemIdle(scpi_t * context);
+scpi_result_t SCPI_SystemIdleQ(scpi_t * context);
+scpi_result_t SCPI_SystemTaskQ(scpi_t * context);
+scpi_result_t SCPI_SystemTaskReset(scpi_t * context);
 
-void doTrigger();
+// deprecated: a bus trigger, same as scpi_trigger_bus(). Kept for firmware that called it
+void doTrigger() __attribute__((deprecated("use scpi_trigger_bus()")));
 
+// stream program message bytes as they arrive from the bus
 scpi_bool_t scpi_instrument_input(const char * data, int len);
+// END (USBTMC EOM) received: execute what's left of the message
+scpi_bool_t scpi_instrument_input_end();
+// device clear: drop partially received input
+void scpi_instrument_input_clear();
+// takes the replies of scpi_instrument_execute()
+typedef void (*scpi_capture_t)(const char * data, size_t len, void * context);
+// run resolved units (see scpi_dispatch_resolve) between messages. With a capture, the replies
+// go there instead of to the host
+void scpi_instrument_execute(const char * units, size_t len, const uint16_t * commands, size_t count,
+        scpi_capture_t capture, void * capture_context);
 
 scpi_t * getScpiContext();
 
@@ -65,6 +208,8 @@ int SCPI_Error(scpi_t * context, int_fast16_t err);
 scpi_result_t SCPI_Control(scpi_t * context, scpi_ctrl_name_t ctrl, scpi_reg_val_t val);
 scpi_result_t SCPI_Reset(scpi_t * context);
 scpi_result_t SCPI_Flush(scpi_t * context);
+// definite length block reply, sent from the producer's memory
+size_t SCPI_ResultBlockProducer(scpi_t * context, size_t len, usbtmc_block_producer_t producer, void * producer_context);
 
 // helper functions to simplyfy integration of TinyUSB tmcusb and the scpi-lib
 uint8_t getSTB();
@@ -0,0 +1,71 @@
+#ifndef SCPI_SCPI_DISPATCH_H
+#define SCPI_SCPI_DISPATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "scpi/scpi.h"
+
+/*
+ * Command table index. The scpi lib looks up a header by matching it against every
+ * pattern of the command list. At init, the commands are grouped in buckets by the root
+ * keyword of their pattern. Before a program message is parsed, the lib gets a command
+ * list with only the buckets of the root keywords that the message uses.
+ * Headers that were matched before are remembered in a small cache. When all headers of
+ * a message are in there, the lib only gets their commands.
+ */
+
+// commands in the table that can be indexed. A longer table is searched without index
+#ifndef SCPI_DISPATCH_MAX_COMMANDS
+#define SCPI_DISPATCH_MAX_COMMANDS 512
+#endif
+// root keyword buckets, power of 2, at most 64. A table with more root keywords is searched without index
+#ifndef SCPI_DISPATCH_BUCKETS
+#define SCPI_DISPATCH_BUCKETS 64
+#endif
+// longest command list that's handed to the lib for one message. Longer: the whole table
+#ifndef SCPI_DISPATCH_LIST_LENGTH
+#define SCPI_DISPATCH_LIST_LENGTH 96
+#endif
+
+// longest header of a resolved unit, composed with its path
+#ifndef SCPI_DISPATCH_RESOLVE_HEADER_LENGTH
+#define SCPI_DISPATCH_RESOLVE_HEADER_LENGTH 64
+#endif
+
+// recently matched headers that are remembered
+#ifndef SCPI_DISPATCH_CACHE_SIZE
+#define SCPI_DISPATCH_CACHE_SIZE 4
+#endif
+// longest header (with its path) that is cached
+#ifndef SCPI_DISPATCH_CACHE_HEADER_LENGTH
+#define SCPI_DISPATCH_CACHE_HEADER_LENGTH 32
+#endif
+
+void scpi_dispatch_init(const scpi_command_t * commands);
+// forget the program message units of the previous message
+void scpi_dispatch_begin();
+// program message unit header, and the header path it's relative to (see composeCompoundCommand)
+void scpi_dispatch_unit(const char * path, size_t path_len, const char * header, size_t header_len);
+// the header path of a unit isn't known: the message is parsed with the full table
+void scpi_dispatch_unknown();
+// point the context at the command list for the message, and back at the full table
+void scpi_dispatch_select(scpi_t * context);
+void scpi_dispatch_restore(scpi_t * context);
+// resolve program message units, e.g. a macro body: every header made absolute, the way the lib
+// composes a compound header with the path of the one before, and matched to its command.
+// out_len and count: in the room, out what's used. On failure, error is SCPI_ERROR_UNDEFINED_HEADER
+// for a header without command, SCPI_ERROR_EXECUTION_ERROR when there isn't enough room
+bool scpi_dispatch_resolve(const char * units, size_t len, char * out, size_t * out_len,
+        uint16_t * commands, size_t * count, int16_t * error);
+// point the context at the commands of resolved units, without touching what's known about
+// the message that's being received. scpi_dispatch_restore() goes back to the full table
+void scpi_dispatch_select_commands(scpi_t * context, const uint16_t * commands, size_t count);
+// table number of the command that the lib matched last. False if none
+bool scpi_dispatch_matched(const scpi_t * context, uint16_t * command);
+// header cache hits and misses, one per program message unit. The units of a message count as
+// hits when the message is dispatched from the cache, as misses when it needs the index or the table
+void scpi_dispatch_cache_stats(uint32_t * hits, uint32_t * misses);
+void scpi_dispatch_cache_reset();
+
+#endif // SCPI_SCPI_DISPATCH_H
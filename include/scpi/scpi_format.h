@@ -0,0 +1,45 @@
+#ifndef SCPI_SCPI_FORMAT_H
+#define SCPI_SCPI_FORMAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "scpi/scpi.h"
+
+/*
+ * FORMat subsystem (SCPI std V1999.0 9). Numeric results that go through the
+ * SCPI_ResultData functions below follow FORMat:DATA:
+ *   ASCii       comma separated numbers, like the SCPI lib's results
+ *   REAL,32     IEEE 754 single precision \
+ *   INTeger,16  two's complement          - one definite length block per result
+ *   INTeger,32  two's complement          /
+ * Values are converted to the selected type: floats are rounded, and saturate at the
+ * limits of an integer type. FORMat:BORDer NORMal sends the most significant byte first,
+ * SWAPped the least significant byte first. *RST: ASCii, NORMal.
+ */
+
+void scpi_format_reset();
+
+size_t SCPI_ResultDataInt32(scpi_t * context, int32_t value);
+size_t SCPI_ResultDataFloat(scpi_t * context, float value);
+size_t SCPI_ResultDataArrayInt16(scpi_t * context, const int16_t * data, size_t count);
+size_t SCPI_ResultDataArrayInt32(scpi_t * context, const int32_t * data, size_t count);
+size_t SCPI_ResultDataArrayFloat(scpi_t * context, const float * data, size_t count);
+// for data that stays put until the host has read the reply: when the values already have the
+// selected type and byte order, they're sent from data instead of being copied into the reply
+size_t SCPI_ResultDataArrayFloatStatic(scpi_t * context, const float * data, size_t count);
+// the memory that a Static result is still sent from: len bytes at data. False when there's none
+bool scpi_format_static_pending(const void ** data, size_t * len);
+// one array result from several parts, e.g. the two halves of a ring buffer:
+// Begin with the total count, then parts that add up to it. The parts are copied into the reply.
+size_t SCPI_ResultDataArrayBegin(scpi_t * context, size_t count);
+size_t SCPI_ResultDataArrayInt16Part(scpi_t * context, const int16_t * data, size_t count);
+size_t SCPI_ResultDataArrayInt32Part(scpi_t * context, const int32_t * data, size_t count);
+size_t SCPI_ResultDataArrayFloatPart(scpi_t * context, const float * data, size_t count);
+
+scpi_result_t SCPI_FormatData(scpi_t * context);
+scpi_result_t SCPI_FormatDataQ(scpi_t * context);
+scpi_result_t SCPI_FormatBorder(scpi_t * context);
+scpi_result_t SCPI_FormatBorderQ(scpi_t * context);
+
+#endif // SCPI_SCPI_FORMAT_H
@@ -0,0 +1,56 @@
+#ifndef SCPI_SCPI_LOG_H
+#define SCPI_SCPI_LOG_H
+
+#include <stdint.h>
+#include "scpi/scpi.h"
+
+/*
+ * Event journal: errors that the SCPI lib reports (also the ones the error queue has no room
+ * for), device clear, Bulk-IN and Bulk-OUT abort and TRIGGER, each with its time_us_64().
+ * SYSTem:LOG? drains it, after the fact.
+ * Each core writes to its own ring, without locks: the writer never waits, and when a ring is
+ * full the oldest entries are overwritten. The reader checks each entry's sequence number, so
+ * it skips entries that were overwritten while it read them, and counts them as lost.
+ * Not for interrupt handlers: one writer per ring.
+ */
+
+// entries in the ring of each core, a power of 2
+#ifndef SCPI_LOG_DEPTH
+#define SCPI_LOG_DEPTH 32u
+#endif
+// one ring for each core that writes
+#if USBTMC_APP_DUAL_CORE
+#define SCPI_LOG_RINGS 2u
+#else
+#define SCPI_LOG_RINGS 1u
+#endif
+
+// id, name in the SYSTem:LOG? reply
+#define SCPI_LOG_EVENTS(X) \
+    X(ERROR, "ERR") \
+    X(OVERFLOW, "OVFL") \
+    X(CLEAR, "CLR") \
+    X(ABORT_IN, "ABIN") \
+    X(ABORT_OUT, "ABOUT") \
+    X(TRIGGER, "TRG")
+
+typedef enum {
+#define SCPI_LOG_ENUM(id, name) SCPI_LOG_##id,
+    SCPI_LOG_EVENTS(SCPI_LOG_ENUM)
+#undef SCPI_LOG_ENUM
+    SCPI_LOG_EVENT_COUNT
+} scpi_log_event_t;
+
+typedef struct {
+    uint64_t time;              // us
+    volatile uint32_t sequence; // index + 1 when the entry is complete, 0 while it's written
+    uint8_t event;
+    int16_t code;               // error number, 0 for the other events
+} scpi_log_entry_t;
+
+// record an event on the calling core's ring
+void scpi_log(scpi_log_event_t event, int16_t code);
+
+scpi_result_t SCPI_SystemLogQ(scpi_t * context);
+
+#endif // SCPI_SCPI_LOG_H
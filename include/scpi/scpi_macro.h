@@ -0,0 +1,56 @@
+#ifndef SCPI_SCPI_MACRO_H
+#define SCPI_SCPI_MACRO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "scpi/scpi.h"
+
+/*
+ * IEEE 488.2 macros (10.7, 10.8, 10.13, 10.18, 10.22, 10.25): *DMC <label>,<body> defines a
+ * macro, sending <label> as a command header runs the body while *EMC is 1.
+ * The body is resolved when it's defined: each program message unit gets an absolute header and
+ * the number of the command it matches. Running it hands the lib the resolved units and a command
+ * list with only their commands, so no header path is composed and no command table is searched.
+ * Bodies can't call other macros, and don't take parameters ($1...).
+ * *RST sets *EMC 0 and keeps the macros.
+ * Built with the CMake option PSL_MACRO, which defines SCPI_MACRO.
+ */
+
+#ifndef SCPI_MACRO
+#define SCPI_MACRO 0
+#endif
+
+#ifndef SCPI_MACRO_COUNT
+#define SCPI_MACRO_COUNT 8u
+#endif
+#ifndef SCPI_MACRO_LABEL_LENGTH
+#define SCPI_MACRO_LABEL_LENGTH 12u
+#endif
+// program message units in one body
+#ifndef SCPI_MACRO_UNITS
+#define SCPI_MACRO_UNITS 32u
+#endif
+// bytes for all bodies, as defined and resolved
+#ifndef SCPI_MACRO_ARENA
+#define SCPI_MACRO_ARENA 2048u
+#endif
+
+// *RST: disable macros
+void scpi_macro_reset();
+// the header is the label of a macro, and macros are enabled
+bool scpi_macro_find(const char * header, size_t len, unsigned int * macro);
+// resolved body of a macro, and the table numbers of its commands
+void scpi_macro_get(unsigned int macro, const char ** body, size_t * len, const uint16_t ** commands, size_t * count);
+// the SCPI engine runs a body. Macros can't be changed meanwhile
+void scpi_macro_running(bool running);
+
+scpi_result_t SCPI_CoreDmc(scpi_t * context);
+scpi_result_t SCPI_CoreEmc(scpi_t * context);
+scpi_result_t SCPI_CoreEmcQ(scpi_t * context);
+scpi_result_t SCPI_CoreGmcQ(scpi_t * context);
+scpi_result_t SCPI_CoreLmcQ(scpi_t * context);
+scpi_result_t SCPI_CorePmc(scpi_t * context);
+scpi_result_t SCPI_CoreRmc(scpi_t * context);
+
+#endif // SCPI_SCPI_MACRO_H
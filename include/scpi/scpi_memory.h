@@ -0,0 +1,54 @@
+#ifndef SCPI_SCPI_MEMORY_H
+#define SCPI_SCPI_MEMORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "scpi/scpi.h"
+
+/*
+ * RAM budget of the static buffers. The size of each region is set at build time, with the
+ * PSL_* CMake cache variables (see CMakeLists.txt), and the total is checked against
+ * SCPI_MEMORY_BUDGET when it's compiled. At run time each region keeps the most bytes it
+ * held: SYSTem:MEMory? reports size and high-water mark, to tune footprint from data.
+ * Regions of optional subsystems (PSL_ACQUIRE, PSL_TRACE, PSL_MACRO, PSL_SEQUENCE) that aren't
+ * built have size 0: they don't count, and aren't reported.
+ */
+
+// bytes for all regions. 0: no limit
+#ifndef SCPI_MEMORY_BUDGET
+#define SCPI_MEMORY_BUDGET 0u
+#endif
+
+// id, name in the SYSTem:MEMory? reply
+#define SCPI_MEMORY_REGIONS(X) \
+    X(INPUT, "INPUT") \
+    X(ERROR, "ERROR") \
+    X(RX, "RX") \
+    X(REPLY, "REPLY") \
+    X(ACQUIRE, "ACQUIRE") \
+    X(TRACE, "TRACE") \
+    X(MACRO, "MACRO") \
+    X(SEQUENCE, "SEQUENCE") \
+    X(RESULT, "RESULT") \
+    X(LOG, "LOG")
+
+typedef enum {
+#define SCPI_MEMORY_ENUM(id, name) SCPI_MEMORY_##id,
+    SCPI_MEMORY_REGIONS(SCPI_MEMORY_ENUM)
+#undef SCPI_MEMORY_ENUM
+    SCPI_MEMORY_REGION_COUNT
+} scpi_memory_region_t;
+
+extern volatile uint32_t scpi_memory_high_water[SCPI_MEMORY_REGION_COUNT];
+
+// the region holds this many bytes now. Cheap enough for the data path
+static inline void scpi_memory_use(scpi_memory_region_t region, size_t bytes) {
+    if (bytes > scpi_memory_high_water[region]) {
+        scpi_memory_high_water[region] = (uint32_t) bytes;
+    }
+}
+
+scpi_result_t SCPI_SystemMemoryQ(scpi_t * context);
+scpi_result_t SCPI_SystemMemoryReset(scpi_t * context);
+
+#endif // SCPI_SCPI_MEMORY_H
@@ -0,0 +1,33 @@
+#ifndef SCPI_SCPI_OPERATION_H
+#define SCPI_SCPI_OPERATION_H
+
+#include <stdbool.h>
+#include "scpi/scpi.h"
+
+/*
+ * Overlapped commands (IEEE 488.2 12.5.2). A command that takes time starts an operation
+ * and returns. The operation is polled by the SCPI engine while it waits for the host,
+ * until it reports done. *OPC, *OPC? and *WAI wait for all pending operations.
+ */
+
+// operations that can be pending at the same time
+#ifndef SCPI_OPERATION_SLOTS
+#define SCPI_OPERATION_SLOTS 4
+#endif
+
+// background part of an overlapped command. Return true when the operation is complete
+typedef bool (*scpi_operation_poll_t)(void * context);
+
+// start an overlapped operation. False when all slots are in use
+bool scpi_operation_start(scpi_operation_poll_t poll, void * context);
+bool scpi_operation_pending();
+// poll the pending operations. Called when the SCPI engine has nothing else to do
+void scpi_operation_task();
+// device clear: back to Operation Complete Command Idle and Query Idle state
+void scpi_operation_clear();
+
+scpi_result_t My_CoreOpc(scpi_t * context);
+scpi_result_t My_CoreOpcQ(scpi_t * context);
+scpi_result_t My_CoreWai(scpi_t * context);
+
+#endif // SCPI_SCPI_OPERATION_H
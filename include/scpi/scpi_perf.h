@@ -0,0 +1,50 @@
+#ifndef SCPI_SCPI_PERF_H
+#define SCPI_SCPI_PERF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "scpi/scpi.h"
+
+/*
+ * Latency of each program message, per command pattern, in three stages:
+ * wait:    first Bulk-OUT packet received until the SCPI engine starts executing
+ * execute: time spent in the SCPI lib and the command callbacks
+ * reply:   message executed until the host has read the last byte of the reply
+ * Each stage keeps count, min, max and a histogram with log2 buckets: bucket 0 is < 2 us,
+ * bucket n is 2^n up to 2^(n+1) us, the last one takes everything above.
+ * A message with more program message units counts for the last command that was matched.
+ */
+
+// command patterns that are measured. Once all are taken, other commands aren't
+#ifndef SCPI_PERF_COMMANDS
+#define SCPI_PERF_COMMANDS 16
+#endif
+#ifndef SCPI_PERF_BUCKETS
+#define SCPI_PERF_BUCKETS 20
+#endif
+// replies from this many bytes count for the best throughput
+#ifndef SCPI_PERF_THROUGHPUT_MIN
+#define SCPI_PERF_THROUGHPUT_MIN 1024u
+#endif
+
+// hooks for the USBTMC layer and the SCPI engine. Times are time_us_32()
+void scpi_perf_message(uint32_t received);
+void scpi_perf_execute_begin();
+void scpi_perf_execute_end(const scpi_t * context);
+void scpi_perf_message_done(bool reply);
+// a Bulk-IN transfer of the reply starts, first: the reply's first one. Called from the USB side
+void scpi_perf_reply_transfer(size_t len, bool first);
+// the last Bulk-IN transfer of the reply is complete. Called from the USB side
+void scpi_perf_reply_done();
+// usbtmc_app_idle() slept this long. Called from the USB side
+void scpi_perf_idle(uint32_t us);
+void scpi_perf_reset();
+
+scpi_result_t SCPI_SystemPerformanceQ(scpi_t * context);
+scpi_result_t SCPI_SystemPerformanceHistogramQ(scpi_t * context);
+scpi_result_t SCPI_SystemPerformanceReset(scpi_t * context);
+scpi_result_t SCPI_SystemPerformanceThroughputQ(scpi_t * context);
+scpi_result_t SCPI_SystemPerformanceIdleQ(scpi_t * context);
+
+#endif // SCPI_SCPI_PERF_H
@@ -0,0 +1,67 @@
+#ifndef SCPI_SCPI_SEQUENCE_H
+#define SCPI_SCPI_SEQUENCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "scpi/scpi.h"
+
+/*
+ * Sequence (LIST) engine: the host uploads steps of program message units with a dwell time,
+ * SEQuence:STARt runs them on the device without the host, SEQuence:RESult? reads the replies
+ * at the end. The units are resolved when the step is added, like a macro body.
+ *
+ * Step deadlines are absolute times on the microsecond timer: step n+1 is due <dwell> us after
+ * step n was due, so the time a step takes, or a late start, doesn't add up over the run.
+ * The SCPI engine polls the sequence next to the overlapped operations. The last
+ * SCPI_SEQUENCE_SPIN_US before a deadline it waits in a busy loop, to start the step on time.
+ * A step runs between two program message units of the host, not in the middle of one. It doesn't
+ * wait for the end of a host message: while the host is sending one, a step can run between
+ * two of its packets. It does wait for whatever the SCPI engine is doing: a slow command, or
+ * a reply that's larger than the reply buffer and waits for the host to read it. So the timing
+ * depends on the host reading its replies, and lateness has no bound: SEQuence:STATe? reports
+ * the worst. In single core mode the steps also share the main loop with USB and the
+ * instrument's tasks.
+ * Built with the CMake option PSL_SEQUENCE, which defines SCPI_SEQUENCE.
+ */
+
+#ifndef SCPI_SEQUENCE
+#define SCPI_SEQUENCE 0
+#endif
+
+#ifndef SCPI_SEQUENCE_STEPS
+#define SCPI_SEQUENCE_STEPS 64u
+#endif
+// resolved units of all steps
+#ifndef SCPI_SEQUENCE_TEXT
+#define SCPI_SEQUENCE_TEXT 2048u
+#endif
+// commands of all steps
+#ifndef SCPI_SEQUENCE_COMMANDS
+#define SCPI_SEQUENCE_COMMANDS 128u
+#endif
+// replies of a run. What doesn't fit is dropped, and counted
+#ifndef SCPI_SEQUENCE_RESULT
+#define SCPI_SEQUENCE_RESULT 2048u
+#endif
+#ifndef SCPI_SEQUENCE_SPIN_US
+#define SCPI_SEQUENCE_SPIN_US 100u
+#endif
+
+// *RST: stop, and delete the steps
+void scpi_sequence_reset();
+// run the step that's due. Polled by the SCPI engine on every pass of its loop. Between steps it
+// posts the next deadline with usbtmc_app_wake_at(), so the engine sleeps until then
+void scpi_sequence_task();
+
+scpi_result_t SCPI_SequenceClear(scpi_t * context);
+scpi_result_t SCPI_SequenceStep(scpi_t * context);
+scpi_result_t SCPI_SequenceStepCountQ(scpi_t * context);
+scpi_result_t SCPI_SequenceCount(scpi_t * context);
+scpi_result_t SCPI_SequenceCountQ(scpi_t * context);
+scpi_result_t SCPI_SequenceStart(scpi_t * context);
+scpi_result_t SCPI_SequenceAbort(scpi_t * context);
+scpi_result_t SCPI_SequenceStateQ(scpi_t * context);
+scpi_result_t SCPI_SequenceResultQ(scpi_t * context);
+
+#endif // SCPI_SCPI_SEQUENCE_H
@@ -0,0 +1,44 @@
+#ifndef SCPI_SCPI_STATUS_H
+#define SCPI_SCPI_STATUS_H
+
+#include <stdint.h>
+#include "scpi/scpi.h"
+
+/*
+ * QUEStionable and OPERation status registers (SCPI std V1999.0 9.1). The instrument sets and
+ * clears condition bits with scpi_status_set() and scpi_status_clear(), from interrupt handlers
+ * too, on either core: each change is one short critical section, so no update gets lost.
+ * A rising condition bit that's in the PTRansition filter, or a falling one in the NTRansition
+ * filter, latches its event. The SCPI engine moves latched events into the SCPI lib's event
+ * register (scpi_status_task()), and the lib summarises event & ENABle into STB (QES, OPS),
+ * with a service request when *SRE asks for it.
+ * STATus:PRESet: PTRansition 0x7FFF, NTRansition 0, ENABle 0. *RST leaves them alone.
+ */
+
+typedef enum {
+    SCPI_STATUS_QUESTIONABLE,
+    SCPI_STATUS_OPERATION,
+    SCPI_STATUS_REGISTER_COUNT
+} scpi_status_register_t;
+
+void scpi_status_init();
+// instrument side, also from interrupts
+void scpi_status_set(scpi_status_register_t reg, uint16_t bits);
+void scpi_status_clear(scpi_status_register_t reg, uint16_t bits);
+uint16_t scpi_status_condition(scpi_status_register_t reg);
+// SCPI engine: hand the latched events to the SCPI lib
+void scpi_status_task();
+
+scpi_result_t SCPI_StatusQuestionableCondQ(scpi_t * context);
+scpi_result_t SCPI_StatusQuestionablePtr(scpi_t * context);
+scpi_result_t SCPI_StatusQuestionablePtrQ(scpi_t * context);
+scpi_result_t SCPI_StatusQuestionableNtr(scpi_t * context);
+scpi_result_t SCPI_StatusQuestionableNtrQ(scpi_t * context);
+scpi_result_t SCPI_StatusOperationCondQ(scpi_t * context);
+scpi_result_t SCPI_StatusOperationPtr(scpi_t * context);
+scpi_result_t SCPI_StatusOperationPtrQ(scpi_t * context);
+scpi_result_t SCPI_StatusOperationNtr(scpi_t * context);
+scpi_result_t SCPI_StatusOperationNtrQ(scpi_t * context);
+scpi_result_t SCPI_StatusPresetFilters(scpi_t * context);
+
+#endif // SCPI_SCPI_STATUS_H
@@ -0,0 +1,61 @@
+#ifndef SCPI_SCPI_TRACE_H
+#define SCPI_SCPI_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "scpi/scpi.h"
+
+/*
+ * TRACe subsystem (SCPI std V1999.0 20): named traces of float points, defined with a fixed
+ * size in one static arena. Instrument code appends points, the host reads them back in parts
+ * with TRACe:DATA? name,start,count. With FORMat:DATA REAL,32 in the native byte order
+ * (SWAPped on the RP2040), the points are sent straight from the arena.
+ *
+ * A trace takes the first gap in the arena that fits. Points don't move: a deleted trace's
+ * space is reused by the next trace that fits in it. Points that a TRACe:DATA? reply still
+ * sends from the arena are pinned until the host has read them: a cleared or deleted trace's
+ * points can't be overwritten by an append or a new trace before then.
+ *
+ * The traces aren't locked: call scpi_trace_append() from the SCPI engine only (instrument
+ * commands, or tasks that run between messages), not from interrupts, trigger actions or the
+ * other core.
+ *
+ * Built with the CMake option PSL_TRACE, which defines SCPI_TRACE.
+ */
+
+#ifndef SCPI_TRACE
+#define SCPI_TRACE 0
+#endif
+
+// points in the arena, shared by all traces
+#ifndef SCPI_TRACE_ARENA_POINTS
+#define SCPI_TRACE_ARENA_POINTS 4096u
+#endif
+#ifndef SCPI_TRACE_COUNT
+#define SCPI_TRACE_COUNT 8u
+#endif
+#ifndef SCPI_TRACE_NAME_LENGTH
+#define SCPI_TRACE_NAME_LENGTH 12u
+#endif
+
+// index of a trace. Stays valid until the trace is deleted
+typedef int scpi_trace_t;
+#define SCPI_TRACE_NONE (-1)
+
+// *RST: delete all traces
+void scpi_trace_reset();
+scpi_trace_t scpi_trace_find(const char * name, size_t len);
+// add a point at the end of the trace. False when the trace is full or doesn't exist, or when
+// the point would overwrite pinned points
+bool scpi_trace_append(scpi_trace_t trace, float point);
+
+scpi_result_t SCPI_TraceDefine(scpi_t * context);
+scpi_result_t SCPI_TraceDelete(scpi_t * context);
+scpi_result_t SCPI_TraceDeleteAll(scpi_t * context);
+scpi_result_t SCPI_TraceClear(scpi_t * context);
+scpi_result_t SCPI_TraceCatalogQ(scpi_t * context);
+scpi_result_t SCPI_TracePointsQ(scpi_t * context);
+scpi_result_t SCPI_TraceFreeQ(scpi_t * context);
+scpi_result_t SCPI_TraceDataQ(scpi_t * context);
+
+#endif // SCPI_SCPI_TRACE_H
@@ -0,0 +1,49 @@
+#ifndef SCPI_SCPI_TRIGGER_H
+#define SCPI_SCPI_TRIGGER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "scpi/scpi.h"
+
+/*
+ * Trigger system (SCPI std V1999.0 2.1). INITiate takes it from idle to waiting for a trigger.
+ * Each accepted trigger runs the armed actions, in the order they were armed. After ARM:COUNt
+ * triggers it returns to idle and the armed actions are dropped. INITiate is an overlapped
+ * command: *OPC completes when the trigger system is idle again.
+ *
+ * A bus trigger (*TRG or the USB488 TRIGGER message) runs the actions straight from where it
+ * arrives. With the SCPI engine on its own core that's the USB core: keep actions short, and
+ * don't call the SCPI library from them.
+ */
+
+// actions that can be armed at the same time
+#ifndef SCPI_TRIGGER_QUEUE_DEPTH
+#define SCPI_TRIGGER_QUEUE_DEPTH 8
+#endif
+// highest ARM:COUNt. With source IMMediate, INITiate runs the actions this many times before
+// the SCPI engine gets to the next command
+#ifndef SCPI_TRIGGER_ARM_COUNT_MAX
+#define SCPI_TRIGGER_ARM_COUNT_MAX 10000u
+#endif
+
+typedef void (*scpi_trigger_action_t)(void * context);
+
+void scpi_trigger_init();
+// arm an action for the next trigger cycle. False when the queue is full
+bool scpi_trigger_arm(scpi_trigger_action_t action, void * context);
+// *TRG or USB488 TRIGGER. False when the trigger is ignored (not waiting, or source isn't BUS)
+bool scpi_trigger_bus();
+// ABORt and *RST: back to idle, drop the armed actions
+void scpi_trigger_abort();
+
+scpi_result_t SCPI_Initiate(scpi_t * context);
+scpi_result_t SCPI_Abort(scpi_t * context);
+scpi_result_t SCPI_ArmCount(scpi_t * context);
+scpi_result_t SCPI_ArmCountQ(scpi_t * context);
+scpi_result_t SCPI_TriggerSource(scpi_t * context);
+scpi_result_t SCPI_TriggerSourceQ(scpi_t * context);
+scpi_result_t SCPI_TriggerTimestampQ(scpi_t * context);
+scpi_result_t SCPI_TriggerLatencyQ(scpi_t * context);
+scpi_result_t SCPI_VisaTrg(scpi_t * context);
+
+#endif // SCPI_SCPI_TRIGGER_H
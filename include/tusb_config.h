@@ -78,6 +78,27 @@
 #define CFG_TUD_USBTMC_ENABLE_INT_EP  1
 #define CFG_TUD_USBTMC_ENABLE_488     1
 
+// USBTMC interrupt IN endpoint, that carries the SRQ notifications
+#define USBTMC_INT_EP_IN              0x82
+// how often the host polls it, in frames (1 ms at full speed), 1 - 255.
+// That's the worst case delay between a service request and the host seeing it
+#ifndef USBTMC_INT_EP_INTERVAL
+#define USBTMC_INT_EP_INTERVAL        16u
+#endif
+
+// vendor class bulk pipe next to USBTMC, that streams the acquisition samples.
+// Set by the PSL_VENDOR_STREAM CMake option
+#ifndef CFG_TUD_VENDOR
+#define CFG_TUD_VENDOR                0
+#endif
+#define CFG_TUD_VENDOR_RX_BUFSIZE     64
+// samples waiting for the host, in bytes
+#ifndef CFG_TUD_VENDOR_TX_BUFSIZE
+#define CFG_TUD_VENDOR_TX_BUFSIZE     1024
+#endif
+#define USB_STREAM_EP_OUT             0x03
+#define USB_STREAM_EP_IN              0x83
+
 #ifdef __cplusplus
  }
 #endif
@@ -0,0 +1,33 @@
+#ifndef USB_USB_STREAM_H
+#define USB_USB_STREAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Raw bulk stream of the acquisition samples, on a vendor class interface next to USBTMC
+ * (PSL_VENDOR_STREAM). SCPI switches it on and off (STReam ON|OFF), the samples go from the
+ * acquisition ring to the bulk IN endpoint without USBTMC headers or Bulk-IN requests:
+ * 16 bit, little endian, for as long as the host reads. While it's on, the stream is the
+ * consumer of the ring, instead of FETCh:ARRay?.
+ */
+
+// the device has the stream interface
+bool usb_stream_available(void);
+// longest wait for the USB side to let go of the ring, when the stream is switched off
+#ifndef USB_STREAM_RELEASE_US
+#define USB_STREAM_RELEASE_US 10000u
+#endif
+
+// the SCPI engine switches the stream. Off waits until the USB side has let go of the ring:
+// false when it still holds it after USB_STREAM_RELEASE_US. The ring can't be reset then
+bool usb_stream_enable(bool on);
+bool usb_stream_enabled(void);
+// the host has opened the stream interface
+bool usb_stream_connected(void);
+// bytes that went to the stream endpoint
+uint32_t usb_stream_bytes(void);
+// move samples from the acquisition ring to the endpoint. Called from the USB side
+void usb_stream_task(void);
+
+#endif // USB_USB_STREAM_H
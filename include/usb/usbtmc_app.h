@@ -2,9 +2,90 @@
 #ifndef USBTMC_APP_H
 #define USBTMC_APP_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// reply ring buffer, power of 2. Replies can be larger, they are sent in parts.
+#ifndef USBTMC_REPLY_BUFFER_SIZE
+#define USBTMC_REPLY_BUFFER_SIZE 1024u
+#endif
+// throughput mode: a reply that's still being written goes out from this many bytes, the host
+// reads a part while the SCPI engine fills the rest of the ring buffer
+#ifndef USBTMC_REPLY_STREAM_THRESHOLD
+#define USBTMC_REPLY_STREAM_THRESHOLD (USBTMC_REPLY_BUFFER_SIZE / 2u)
+#endif
+
+// USBTMC_APP_DUAL_CORE: the SCPI engine runs on core 1, USB stays on core 0.
+// Set by the PSL_DUAL_CORE CMake option.
+#ifndef USBTMC_APP_DUAL_CORE
+#define USBTMC_APP_DUAL_CORE 0
+#endif
+
+// Bulk-OUT packets that can wait for the SCPI engine, power of 2. One slot is kept free.
+#ifndef USBTMC_RX_QUEUE_DEPTH
+#if USBTMC_APP_DUAL_CORE
+#define USBTMC_RX_QUEUE_DEPTH 8u
+#else
+#define USBTMC_RX_QUEUE_DEPTH 2u
+#endif
+#endif
+
+// longest sleep in usbtmc_app_idle(), for tasks that poll without asking for a wake up
+#ifndef USBTMC_APP_IDLE_MAX_US
+#define USBTMC_APP_IDLE_MAX_US 10000u
+#endif
+
+// bulk endpoint packet size, see desc_fs_configuration and desc_hs_configuration
+#if defined(TUD_OPT_HIGH_SPEED) && TUD_OPT_HIGH_SPEED
+#define USBTMC_BULK_PACKET_SIZE 512u
+#else
+#define USBTMC_BULK_PACKET_SIZE 64u
+#endif
+
 void usbtmc_app_task_iter(void);
+// the SCPI engine waits for something else than the host (*OPC?, *WAI): keep USB going.
+// Returns false when the wait has to end: device clear, or the host is gone.
+bool usbtmc_app_yield(void);
+#if USBTMC_APP_DUAL_CORE
+// launch the SCPI engine on core 1. Call after scpi_instrument_init(), before tusb_init().
+void usbtmc_app_start_executor(void);
+#endif
+
+// throughput mode, for replies that are written slower than the bus takes them (long ASCII
+// data, acquisitions): parts go out while the reply is written. Costs a Bulk-IN request per
+// part, so replies that are written fast are better off without it. Default: off
+void usbtmc_app_set_throughput(bool on);
+bool usbtmc_app_throughput(void);
+
+// low power: the firmware's main loop calls usbtmc_app_idle() after usbtmc_app_task_iter() and
+// led_blinking_task(). It sleeps (WFE) until an interrupt, an event from the other core, or the
+// earliest time that a task asked for with usbtmc_app_wake_at(), at most USBTMC_APP_IDLE_MAX_US.
+// It returns right away when there's work, and keeps the posted wake time for the next call.
+// Returns the time_us_64() it woke up, 0 when it didn't sleep. Default: on
+// usbtmc_app_pending(): usbtmc_app_task_iter() has a step to take
+uint64_t usbtmc_app_idle(void);
+bool usbtmc_app_pending(void);
+void usbtmc_app_set_idle(bool on);
+bool usbtmc_app_idle_enabled(void);
+// a task of the calling core wants to run again at this time_us_64(). Not from interrupts:
+// an interrupt handler wakes the core that it runs on, usbtmc_app_wake() wakes the other one
+void usbtmc_app_wake_at(uint64_t time);
+void usbtmc_app_wake(void);
+
+/*
+ * Producer of a definite length block reply.
+ * Point *data at the block bytes that start at offset, and return how many are there (up to max).
+ * Return 0 if nothing is available yet, it will be asked again later.
+ * USB sends straight from that memory: it has to stay valid until the next call.
+ * In dual core mode, the producer is called from the USB core.
+ */
+typedef size_t (*usbtmc_block_producer_t)(void *context, size_t offset, size_t max, const uint8_t **data);
 
 void setReply (const char *data, size_t len);
+void setReplyBlock (size_t len, usbtmc_block_producer_t producer, void *context);
+// a block reply of this producer that the host hasn't read completely: its context and length
+bool usbtmc_app_block_pending(usbtmc_block_producer_t producer, void **context, size_t *len);
 void setControlReply ();
 
 #endif
@@ -0,0 +1,78 @@
+#ifndef USB_USBTMC_SCHED_H
+#define USB_USBTMC_SCHED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Cooperative task scheduler for the firmware's main loop (core 0). The library registers its
+ * USB, SCPI and LED tasks with usbtmc_sched_init(), the instrument adds its own with
+ * usbtmc_sched_add(), before the loop starts. The main loop is then:
+ *   while (true) { usbtmc_sched_run(); }
+ * Each pass runs the ready tasks by priority (0 first), tasks of the same priority by earliest
+ * deadline. After a task ran, the polled tasks with a higher priority that have work pending
+ * (usbtmc_sched_set_pending()) run again before the next one: a slow instrument task delays USB
+ * by its own run time, not by the whole pass. A task that
+ * takes longer than that (more than a USB frame) calls usbtmc_app_yield() now and then.
+ * When nothing is ready, the pass ends in usbtmc_app_idle(), until the next periodic task is due.
+ * Tasks aren't preempted, a missed deadline is counted: SYSTem:TASK? shows it.
+ * In dual core mode, the SCPI engine has core 1 to itself and isn't one of these tasks.
+ */
+
+// tasks that can be registered, the library's included
+#ifndef USBTMC_SCHED_TASKS
+#define USBTMC_SCHED_TASKS 8u
+#endif
+
+// 0 runs first
+#define USBTMC_SCHED_PRIORITY_USB 0u
+#define USBTMC_SCHED_PRIORITY_SCPI 1u
+#define USBTMC_SCHED_PRIORITY_INSTRUMENT 2u
+#define USBTMC_SCHED_PRIORITY_LED 3u
+
+// tud_task() runs at least once per USB frame
+#ifndef USBTMC_SCHED_USB_DEADLINE_US
+#define USBTMC_SCHED_USB_DEADLINE_US 1000u
+#endif
+// led_blinking_task(). The blink patterns are 250 ms and longer
+#ifndef USBTMC_SCHED_LED_PERIOD_US
+#define USBTMC_SCHED_LED_PERIOD_US 10000u
+#endif
+
+typedef void (*usbtmc_sched_task_t)(void *context);
+// true when the task has work waiting. Called often: keep it short
+typedef bool (*usbtmc_sched_pending_t)(void *context);
+
+typedef struct {
+    const char *name;
+    uint8_t priority;
+    uint32_t period;    // us
+    uint32_t deadline;  // us
+    uint32_t runs;
+    uint64_t busy;      // us, run time of all runs
+    uint32_t longest;   // us
+    uint32_t missed;    // deadlines
+} usbtmc_sched_stats_t;
+
+// register the library's tasks: USB (tud_task), SCPI (usbtmc_app_task_iter) and LED. Once
+void usbtmc_sched_init(void);
+// period in us, 0: polled, in every pass. deadline in us after the task is due (periodic tasks),
+// or after its previous run (polled tasks). 0: the period, none for a polled task.
+// returns the task's index, -1 when USBTMC_SCHED_TASKS are registered
+int usbtmc_sched_add(const char *name, usbtmc_sched_task_t task, void *context,
+    uint8_t priority, uint32_t period, uint32_t deadline);
+// a polled task runs once per pass. With a pending check, it also runs again after each lower
+// priority task, when the check says there's work. A run without work pending isn't timed
+// (0 us in SYSTem:TASK?)
+void usbtmc_sched_set_pending(int index, usbtmc_sched_pending_t pending);
+// one pass of the main loop
+void usbtmc_sched_run(void);
+
+size_t usbtmc_sched_count(void);
+// statistics of a task since the last usbtmc_sched_reset(). Also from the SCPI engine's core
+bool usbtmc_sched_stats(size_t index, usbtmc_sched_stats_t *stats);
+// clears the statistics, at the start of the next pass
+void usbtmc_sched_reset(void);
+
+#endif // USB_USBTMC_SCHED_H
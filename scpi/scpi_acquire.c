@@ -0,0 +1,235 @@
+#include "scpi/scpi_acquire.h"
+
+#include <string.h>
+
+#include "scpi/scpi_base.h"
+#include "usb/usb_stream.h"
+#include "hardware/sync.h"
+
+static int16_t acquire_ring[SCPI_ACQUIRE_DEPTH];
+_Static_assert((SCPI_ACQUIRE_DEPTH & (SCPI_ACQUIRE_DEPTH - 1u)) == 0u,
+    "SCPI_ACQUIRE_DEPTH must be a power of 2");
+// free running counters, the position in the ring is counter % depth
+static volatile uint32_t acquire_head;          // producer
+static volatile uint32_t acquire_tail;          // SCPI engine, or the stream
+static volatile bool acquire_running;
+
+// written by the producer. Cleared by the SCPI engine while the producer is stopped
+static volatile uint32_t acquire_high_water;    // most samples in the ring at once
+static volatile uint32_t acquire_overruns;      // samples dropped because the ring was full
+
+static scpi_acquire_control_t acquire_control;
+static void * acquire_control_context;
+
+void scpi_acquire_init(scpi_acquire_control_t control, void * context) {
+    acquire_control = control;
+    acquire_control_context = context;
+}
+
+static void acquire_stop() {
+    if (acquire_running && (acquire_control != NULL)) {
+        acquire_control(false, acquire_control_context);
+    }
+    acquire_running = false;
+    __dmb();
+}
+
+bool scpi_acquire_reset() {
+    acquire_stop();
+    if (!usb_stream_enable(false)) {
+        return false; // the USB side still takes samples: leave the ring as it is
+    }
+    acquire_tail = acquire_head;
+    acquire_high_water = 0u;
+    acquire_overruns = 0u;
+    return true;
+}
+
+size_t scpi_acquire_space(int16_t ** data) {
+    if (!acquire_running) {
+        return 0u;
+    }
+    uint32_t head = acquire_head;
+    uint32_t free = SCPI_ACQUIRE_DEPTH - (head - acquire_tail);
+    __dmb(); // the SCPI engine is done with that space
+    uint32_t pos = head & (SCPI_ACQUIRE_DEPTH - 1u);
+    *data = &acquire_ring[pos];
+    return (free < SCPI_ACQUIRE_DEPTH - pos) ? free : SCPI_ACQUIRE_DEPTH - pos;
+}
+
+void scpi_acquire_commit(size_t count) {
+    __dmb(); // samples before head
+    uint32_t head = acquire_head + (uint32_t) count;
+    acquire_head = head;
+    uint32_t fill = head - acquire_tail;
+    if (fill > acquire_high_water) {
+        acquire_high_water = fill;
+        scpi_memory_use(SCPI_MEMORY_ACQUIRE, fill * sizeof(int16_t));
+    }
+}
+
+size_t scpi_acquire_put(const int16_t * data, size_t count) {
+    size_t done = 0u;
+    while (done < count) {
+        int16_t * space;
+        size_t len = scpi_acquire_space(&space);
+        if (!len) {
+            break;
+        }
+        if (len > count - done) {
+            len = count - done;
+        }
+        memcpy(space, &data[done], len * sizeof(int16_t));
+        scpi_acquire_commit(len);
+        done += len;
+    }
+    scpi_acquire_overrun(count - done);
+    return done;
+}
+
+void scpi_acquire_overrun(size_t count) {
+    if (count && acquire_running) {
+        acquire_overruns += (uint32_t) count;
+    }
+}
+
+size_t scpi_acquire_peek(const int16_t ** data) {
+    uint32_t tail = acquire_tail;
+    uint32_t count = acquire_head - tail;
+    __dmb(); // samples before head
+    uint32_t pos = tail & (SCPI_ACQUIRE_DEPTH - 1u);
+    *data = &acquire_ring[pos];
+    return (count < SCPI_ACQUIRE_DEPTH - pos) ? count : SCPI_ACQUIRE_DEPTH - pos;
+}
+
+void scpi_acquire_release(size_t count) {
+    __dmb(); // copied before the producer gets the space back
+    acquire_tail += (uint32_t) count;
+}
+
+/**
+ * INITiate:CONTinuous ON|OFF - start or stop filling the acquisition ring. *RST: OFF
+ * ON starts a new run: the ring is emptied, the counters are cleared. The stream stays as it was
+ */
+scpi_result_t SCPI_InitiateContinuous(scpi_t * context) {
+    scpi_bool_t run;
+    if (!SCPI_ParamBool(context, &run, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    if (!run) {
+        acquire_stop();
+        return SCPI_RES_OK;
+    }
+    if (acquire_running) {
+        return SCPI_RES_OK;
+    }
+    if (acquire_control == NULL) { // the instrument has no producer
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return SCPI_RES_ERR;
+    }
+    bool streaming = usb_stream_enabled();
+    if (!scpi_acquire_reset()) {
+        usb_stream_enable(streaming);
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return SCPI_RES_ERR;
+    }
+    usb_stream_enable(streaming);
+    acquire_running = true;
+    __dmb();
+    acquire_control(true, acquire_control_context);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_InitiateContinuousQ(scpi_t * context) {
+    SCPI_ResultBool(context, acquire_running);
+    return SCPI_RES_OK;
+}
+
+/**
+ * FETCh:ARRay? <n> - the oldest samples in the ring, at most <n>. Fewer, or none, when there
+ * aren't that many. Copied into the reply in parts, each part is handed back to the producer
+ */
+scpi_result_t SCPI_FetchArrayQ(scpi_t * context) {
+    uint32_t max;
+    if (!SCPI_ParamUInt32(context, &max, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    if (usb_stream_enabled()) { // the stream takes the samples
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return SCPI_RES_ERR;
+    }
+    uint32_t count = acquire_head - acquire_tail;
+    if (count > max) {
+        count = max;
+    }
+    SCPI_ResultDataArrayBegin(context, count);
+    while (count) {
+        const int16_t * data;
+        size_t part = scpi_acquire_peek(&data);
+        if (part > count) {
+            part = count;
+        }
+        if (part > SCPI_ACQUIRE_FETCH_PART) {
+            part = SCPI_ACQUIRE_FETCH_PART;
+        }
+        SCPI_ResultDataArrayInt16Part(context, data, part);
+        scpi_acquire_release(part);
+        count -= (uint32_t) part;
+    }
+    return SCPI_RES_OK;
+}
+
+/**
+ * FETCh:ARRay:POINts? - samples in the ring
+ */
+scpi_result_t SCPI_FetchArrayPointsQ(scpi_t * context) {
+    SCPI_ResultUInt32(context, acquire_head - acquire_tail);
+    return SCPI_RES_OK;
+}
+
+/**
+ * FETCh:ARRay:STATistics? - high-water mark (most samples in the ring at once), samples lost
+ * to overrun, and the ring size. Since the last INITiate:CONTinuous ON
+ */
+scpi_result_t SCPI_FetchArrayStatisticsQ(scpi_t * context) {
+    SCPI_ResultUInt32(context, acquire_high_water);
+    SCPI_ResultUInt32(context, acquire_overruns);
+    SCPI_ResultUInt32(context, SCPI_ACQUIRE_DEPTH);
+    return SCPI_RES_OK;
+}
+
+/**
+ * STReam ON|OFF - send the samples to the host on the vendor bulk interface, instead of
+ * FETCh:ARRay?. INITiate:CONTinuous starts and stops the producer. *RST: OFF
+ */
+scpi_result_t SCPI_Stream(scpi_t * context) {
+    scpi_bool_t on;
+    if (!SCPI_ParamBool(context, &on, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    if (on && !usb_stream_available()) { // built without PSL_VENDOR_STREAM
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return SCPI_RES_ERR;
+    }
+    if (!usb_stream_enable(on)) { // off, but the USB side didn't let go of the ring in time
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return SCPI_RES_ERR;
+    }
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_StreamQ(scpi_t * context) {
+    SCPI_ResultBool(context, usb_stream_enabled());
+    return SCPI_RES_OK;
+}
+
+/**
+ * STReam:STATistics? - bytes sent since STReam ON, samples lost to overrun, and whether the
+ * host has the stream interface open (0|1)
+ */
+scpi_result_t SCPI_StreamStatisticsQ(scpi_t * context) {
+    SCPI_ResultUInt32(context, usb_stream_bytes());
+    SCPI_ResultUInt32(context, acquire_overruns);
+    SCPI_ResultBool(context, usb_stream_connected());
+    return SCPI_RES_OK;
+}
@@ -1,6 +1,12 @@
 #include "scpi/scpi_base.h"
 
+#include <ctype.h>
+#include <string.h>
+
 #include "scpi-def.h"
+#include "scpi/scpi_dispatch.h"
+#include "scpi/scpi_macro.h"
+#include "scpi/scpi_perf.h"
 #include "usb/usbtmc_app.h"
 #include "pico/unique_id.h"
 
@@ -19,38 +25,476 @@ scpi_result_t My_CoreTstQ(scpi_t * context) {
     return SCPI_RES_OK;
 }
 
-void triggerHandler() {
-    // this function is the handler for SCPI and usbtmc trigger requests.
-    // current firmware ignores triggers
-    // if there is a use for it, move this to the dedicated module
-    return;
+void doTrigger() {
+    scpi_trigger_bus();
 }
 
 /**
- * *TRG - This command asserts trigger. 
- *        https://www.ni.com/docs/en-US/bundle/labview-api-ref/page/functions/visa-assert-trigger.html
- *        throw SCPI error, because not implemented
- * @param context
- * @return 
+ * SYSTem:DISPatch:CACHe? - hits,misses of the header cache. Each program message unit counts,
+ * a hit only when all headers of its message were in the cache
+ * SYSTem:DISPatch:CACHe:RESet - set the counters to 0
  */
-scpi_result_t SCPI_VisaTrg(scpi_t * context) {
-    triggerHandler();
-    SCPI_ErrorPush(context, SCPI_ERROR_UNDEFINED_HEADER); // TODO: remove when trigger implemented
-    return SCPI_RES_ERR; // TODO: return OK when trigger implemented
+scpi_result_t SCPI_SystemDispatchCacheQ(scpi_t * context) {
+    uint32_t hits;
+    uint32_t misses;
+    scpi_dispatch_cache_stats(&hits, &misses);
+    SCPI_ResultUInt32(context, hits);
+    SCPI_ResultUInt32(context, misses);
+    return SCPI_RES_OK;
 }
-void doTrigger() {
-    triggerHandler();
+
+scpi_result_t SCPI_SystemDispatchCacheReset(scpi_t * context) {
+    (void) context;
+    scpi_dispatch_cache_reset();
+    return SCPI_RES_OK;
+}
+
+/**
+ * SYSTem:COMMunicate:USB:THRoughput ON|OFF - send parts of a long reply while it's written.
+ *      Not changed by *RST. SYSTem:PERFormance:THRoughput? shows what it gives
+ */
+scpi_result_t SCPI_SystemCommunicateUsbThroughput(scpi_t * context) {
+    scpi_bool_t on;
+    if (!SCPI_ParamBool(context, &on, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    usbtmc_app_set_throughput(on);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_SystemCommunicateUsbThroughputQ(scpi_t * context) {
+    SCPI_ResultBool(context, usbtmc_app_throughput());
+    return SCPI_RES_OK;
+}
+
+/**
+ * SYSTem:IDLE ON|OFF - sleep in usbtmc_app_idle() while there's nothing to do, or keep polling.
+ *      Not changed by *RST. SYSTem:PERFormance:IDLE? shows the time asleep
+ */
+scpi_result_t SCPI_SystemIdle(scpi_t * context) {
+    scpi_bool_t on;
+    if (!SCPI_ParamBool(context, &on, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    usbtmc_app_set_idle(on);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_SystemIdleQ(scpi_t * context) {
+    SCPI_ResultBool(context, usbtmc_app_idle_enabled());
+    return SCPI_RES_OK;
+}
+
+/**
+ * SYSTem:TASK? - the tasks of usbtmc_sched_run(), for each: name, priority, period and deadline
+ *      in us, runs, run time in us (total, longest), missed deadlines
+ * SYSTem:TASK:RESet - clear the statistics
+ */
+scpi_result_t SCPI_SystemTaskQ(scpi_t * context) {
+    usbtmc_sched_stats_t stats;
+    for (size_t i = 0u; usbtmc_sched_stats(i, &stats); i++) {
+        SCPI_ResultMnemonic(context, stats.name);
+        SCPI_ResultUInt32(context, stats.priority);
+        SCPI_ResultUInt32(context, stats.period);
+        SCPI_ResultUInt32(context, stats.deadline);
+        SCPI_ResultUInt32(context, stats.runs);
+        SCPI_ResultUInt64(context, stats.busy);
+        SCPI_ResultUInt32(context, stats.longest);
+        SCPI_ResultUInt32(context, stats.missed);
+    }
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_SystemTaskReset(scpi_t * context) {
+    (void) context;
+    usbtmc_sched_reset();
+    return SCPI_RES_OK;
 }
 
 
 scpi_t scpi_context;
 
+/*
+ * Program messages are streamed in as the USB packets arrive.
+ * Bytes are collected in scpi_input_buffer. A message is executed
+ * when its newline or the USBTMC END (EOM) arrives.
+ * A message that doesn't fit the buffer is executed in parts, split on
+ * the last ';' that isn't part of a string or block. The header path of the
+ * executed part is put in front of the next part, so that relative headers
+ * (SOUR:VOLT 1;CURR 2) keep working. Only a single program message unit
+ * has to fit SCPI_INPUT_BUFFER_LENGTH.
+ * Each part (and a macro the message calls) is its own SCPI_Parse, and the lib
+ * ends the response of each one with a line ending. The message has one response:
+ * SCPI_Write holds the line ending back, and puts a response message unit
+ * separator in its place when more follows. The end of the message writes it.
+ */
+typedef enum {
+    stream_normal,
+    stream_quoted,      // inside a string, until the matching quote
+    stream_block_hash,  // got #, next is the digit count of a block length
+    stream_block_len,   // reading the length digits of a definite length block
+    stream_block_data,  // inside a definite length block
+    stream_block_indef, // inside an indefinite length block (#0), until newline
+} t_streamstate;
+
+static struct {
+    size_t len;           // bytes in scpi_input_buffer
+    size_t unit_start;    // where the current program message unit starts
+    size_t boundary;      // last unit separator ';', 0 if none
+    t_streamstate state;
+    char quote;
+    uint8_t block_digits;
+    uint32_t block_len;
+    bool overrun;         // discard the rest of this message
+    bool busy;            // scpi_instrument_input() is running
+    bool clear_pending;   // device clear while busy
+    bool path_pending;    // path has to go in front of the next header
+    char path[SCPI_STREAM_PATH_LENGTH]; // header path of the last unit
+    size_t path_len;
+    size_t header_path;   // length of the path that was put in front of the current unit's header
+    char line_end[2];     // the lib's line ending, held back until the end of the message
+    size_t line_end_len;
+} scpi_stream;
+
+static void stream_reset() {
+    scpi_stream.len = 0u;
+    scpi_stream.unit_start = 0u;
+    scpi_stream.boundary = 0u;
+    scpi_stream.state = stream_normal;
+    scpi_stream.overrun = false;
+    scpi_stream.path_pending = false;
+    scpi_stream.path_len = 0u;
+    scpi_stream.header_path = 0u;
+    scpi_stream.line_end_len = 0u;
+    scpi_dispatch_begin();
+}
+
+// the message is done: end its response
+static void stream_end_response() {
+    if (scpi_stream.line_end_len) {
+        size_t len = scpi_stream.line_end_len;
+        scpi_stream.line_end_len = 0u;
+        setReply(scpi_stream.line_end, len);
+    }
+}
+
+static void stream_execute(size_t len) {
+    scpi_memory_use(SCPI_MEMORY_INPUT, len + 1u);
+    scpi_input_buffer[len] = '\0';
+    scpi_dispatch_select(&scpi_context);
+    scpi_perf_execute_begin();
+    SCPI_Parse(&scpi_context, scpi_input_buffer, (int) len);
+    scpi_perf_execute_end(&scpi_context);
+    scpi_dispatch_restore(&scpi_context);
+}
+
+// replies go here instead of to the host, while resolved units run with a capture
+static scpi_capture_t instrument_capture;
+static void * instrument_capture_context;
+
+void scpi_instrument_execute(const char * units, size_t len, const uint16_t * commands, size_t count,
+        scpi_capture_t capture, void * capture_context) {
+    instrument_capture = capture;
+    instrument_capture_context = capture_context;
+    scpi_dispatch_select_commands(&scpi_context, commands, count);
+    SCPI_Parse(&scpi_context, (char *) units, (int) len);
+    scpi_dispatch_restore(&scpi_context);
+    instrument_capture = NULL;
+}
+
+#if SCPI_MACRO
+// run the resolved body of a macro, with only its commands
+static void stream_execute_macro(unsigned int macro) {
+    const char * body;
+    size_t len;
+    const uint16_t * commands;
+    size_t count;
+    scpi_macro_get(macro, &body, &len, &commands, &count);
+    scpi_macro_running(true);
+    scpi_perf_execute_begin();
+    scpi_instrument_execute(body, len, commands, count, NULL, NULL);
+    scpi_perf_execute_end(&scpi_context);
+    scpi_macro_running(false);
+}
+#endif
+
+// header of the unit that ends at end. Returns its length
+static size_t stream_unit_header(size_t end, size_t * header) {
+    size_t i = scpi_stream.unit_start;
+    while ((i < end) && isspace((unsigned char) scpi_input_buffer[i])) {
+        i++;
+    }
+    *header = i;
+    while ((i < end) && !isspace((unsigned char) scpi_input_buffer[i])) {
+        i++;
+    }
+    return i - *header;
+}
+
+// let the command index know the root keyword of the unit that ends at end
+static void stream_dispatch_unit(size_t end) {
+    size_t header;
+    size_t header_len = stream_unit_header(end, &header);
+    if (!header_len) {
+        return;
+    }
+    if (scpi_stream.path_len > sizeof(scpi_stream.path)) {
+        scpi_dispatch_unknown();
+        return;
+    }
+    scpi_dispatch_unit(scpi_stream.path, scpi_stream.path_len, scpi_input_buffer + header, header_len);
+}
+
+#if SCPI_MACRO
+// the unit that ends at end calls a macro: execute the units before it, then the macro.
+// Empties the buffer
+static bool stream_macro(size_t end) {
+    size_t header;
+    size_t header_len = stream_unit_header(end, &header);
+    size_t skip = scpi_stream.header_path; // a label doesn't take the path of the unit before it
+    unsigned int macro;
+    if (!scpi_macro_find(scpi_input_buffer + header, header_len, &macro)
+            && ((header_len <= skip) || !scpi_macro_find(scpi_input_buffer + header + skip, header_len - skip, &macro))) {
+        return false;
+    }
+    bool params = false;
+    for (size_t i = header + header_len; i < end; i++) {
+        params = params || !isspace((unsigned char) scpi_input_buffer[i]);
+    }
+    if (scpi_stream.boundary) {
+        stream_execute(scpi_stream.boundary);
+    }
+    scpi_dispatch_begin();
+    if (params) {
+        SCPI_ErrorPush(&scpi_context, SCPI_ERROR_PARAMETER_NOT_ALLOWED);
+    } else if (!scpi_stream.clear_pending) {
+        stream_execute_macro(macro);
+    }
+    scpi_stream.len = 0u;
+    scpi_stream.unit_start = 0u;
+    scpi_stream.boundary = 0u;
+    scpi_stream.path_len = 0u;
+    scpi_stream.header_path = 0u;
+    return true;
+}
+#else
+// no macros: a header is never a label
+static bool stream_macro(size_t end) {
+    (void) end;
+    return false;
+}
+#endif
+
+// remember the header path of the unit that ends at end, like the scpi lib composes compound headers
+static void stream_track_path(size_t end) {
+    size_t header;
+    size_t header_len = stream_unit_header(end, &header);
+    if (!header_len) {
+        return;
+    }
+    if (scpi_input_buffer[header] == '*') { // common command: next one starts from the root
+        scpi_stream.path_len = 0u;
+        return;
+    }
+    if (scpi_input_buffer[header] == ':') { // absolute header
+        scpi_stream.path_len = 0u;
+    }
+    // path = path + header, up to its last ':'
+    size_t last = header_len;
+    while ((last > 0u) && (scpi_input_buffer[header + last - 1u] != ':')) {
+        last--;
+    }
+    if (scpi_stream.path_len + last > sizeof(scpi_stream.path)) {
+        scpi_stream.path_len = sizeof(scpi_stream.path) + 1u; // too deep to remember
+        return;
+    }
+    memcpy(scpi_stream.path + scpi_stream.path_len, scpi_input_buffer + header, last);
+    scpi_stream.path_len += last;
+}
+
+// buffer full: execute the complete units, keep the one that is being received
+static bool stream_split() {
+    if (!scpi_stream.boundary || (scpi_stream.path_len > sizeof(scpi_stream.path))) {
+        return false;
+    }
+    size_t boundary = scpi_stream.boundary;
+    size_t rest = scpi_stream.len - (boundary + 1u);
+    // the path is composed before the buffer gets reused by the parser
+    char path[SCPI_STREAM_PATH_LENGTH];
+    size_t path_len = scpi_stream.path_len;
+    memcpy(path, scpi_stream.path, path_len);
+
+    stream_execute(boundary);
+    scpi_dispatch_begin();
+    if (scpi_stream.clear_pending) {
+        return true;
+    }
+
+    memmove(scpi_input_buffer, scpi_input_buffer + boundary + 1u, rest);
+    scpi_stream.len = rest;
+    scpi_stream.unit_start = 0u;
+    scpi_stream.boundary = 0u;
+    scpi_stream.path_len = 0u;
+    scpi_stream.header_path = 0u;
+
+    // put the path in front of the unit's header, or when that header arrives
+    size_t i = 0u;
+    while ((i < rest) && isspace((unsigned char) scpi_input_buffer[i])) {
+        i++;
+    }
+    if (i == rest) {
+        scpi_stream.len = 0u;
+        memcpy(scpi_stream.path, path, path_len);
+        scpi_stream.path_len = path_len;
+        scpi_stream.path_pending = (path_len > 0u);
+        return true;
+    }
+    if ((scpi_input_buffer[i] == '*') || (scpi_input_buffer[i] == ':') || !path_len) {
+        return true;
+    }
+    if (rest + path_len >= SCPI_INPUT_BUFFER_LENGTH) {
+        return false;
+    }
+    memmove(scpi_input_buffer + i + path_len, scpi_input_buffer + i, rest - i);
+    memcpy(scpi_input_buffer + i, path, path_len);
+    scpi_stream.len += path_len;
+    scpi_stream.header_path = path_len;
+    return true;
+}
+
+static void stream_put(char c) {
+    // one position reserved for the string terminator. A split can leave the path pending: it
+    // goes in front of this character
+    if ((scpi_stream.len + 1u >= SCPI_INPUT_BUFFER_LENGTH) && !stream_split()) {
+        SCPI_ErrorPush(&scpi_context, SCPI_ERROR_INPUT_BUFFER_OVERRUN);
+        scpi_memory_use(SCPI_MEMORY_INPUT, SCPI_INPUT_BUFFER_LENGTH);
+        stream_end_response(); // of the parts that were executed
+        stream_reset();
+        scpi_stream.overrun = true;
+    }
+    if (scpi_stream.path_pending && !isspace((unsigned char) c)) {
+        scpi_stream.path_pending = false;
+        if ((c != '*') && (c != ':')) {
+            memcpy(scpi_input_buffer, scpi_stream.path, scpi_stream.path_len);
+            scpi_stream.len = scpi_stream.path_len;
+            scpi_stream.header_path = scpi_stream.path_len;
+        }
+        // from here on, the buffer carries the path
+        scpi_stream.path_len = 0u;
+    }
+    if (scpi_stream.overrun) {
+        if (c == '\n') { // the next message is fine again
+            scpi_stream.overrun = false;
+        }
+        return;
+    }
+    size_t pos = scpi_stream.len;
+    scpi_input_buffer[scpi_stream.len++] = c;
+
+    switch (scpi_stream.state) {
+    case stream_normal:
+        if ((c == '"') || (c == '\'')) {
+            scpi_stream.quote = c;
+            scpi_stream.state = stream_quoted;
+        } else if (c == '#') {
+            scpi_stream.state = stream_block_hash;
+        } else if (c == ';') {
+            if (stream_macro(pos)) {
+                break;
+            }
+            stream_dispatch_unit(pos);
+            stream_track_path(pos);
+            scpi_stream.boundary = pos;
+            scpi_stream.unit_start = pos + 1u;
+            scpi_stream.header_path = 0u;
+        } else if (c == '\n') {
+            if (!stream_macro(pos)) {
+                stream_dispatch_unit(pos);
+                stream_execute(scpi_stream.len);
+            }
+            stream_end_response();
+            stream_reset();
+        }
+        break;
+    case stream_quoted: // a doubled quote is an escaped quote, toggling twice handles that
+        if (c == scpi_stream.quote) {
+            scpi_stream.state = stream_normal;
+        }
+        break;
+    case stream_block_hash:
+        if (c == '0') {
+            scpi_stream.state = stream_block_indef;
+        } else if ((c > '0') && (c <= '9')) {
+            scpi_stream.block_digits = (uint8_t) (c - '0');
+            scpi_stream.block_len = 0u;
+            scpi_stream.state = stream_block_len;
+        } else { // #H, #Q, #B numbers
+            scpi_stream.state = stream_normal;
+        }
+        break;
+    case stream_block_len:
+        scpi_stream.block_len = (scpi_stream.block_len * 10u) + (uint32_t) (c - '0');
+        if (--scpi_stream.block_digits == 0u) {
+            scpi_stream.state = scpi_stream.block_len ? stream_block_data : stream_normal;
+        }
+        break;
+    case stream_block_data:
+        if (--scpi_stream.block_len == 0u) {
+            scpi_stream.state = stream_normal;
+        }
+        break;
+    case stream_block_indef:
+        if (c == '\n') {
+            stream_dispatch_unit(pos);
+            stream_execute(scpi_stream.len);
+            stream_end_response();
+            stream_reset();
+        }
+        break;
+    default:
+        break;
+    }
+}
+
 scpi_bool_t scpi_instrument_input(const char * data, int len) {
-    return SCPI_Input(&scpi_context, data, len);
+    scpi_stream.busy = true;
+    for (int i = 0; (i < len) && !scpi_stream.clear_pending; i++) {
+        stream_put(data[i]);
+    }
+    scpi_stream.busy = false;
+    if (scpi_stream.clear_pending) {
+        scpi_stream.clear_pending = false;
+        stream_reset();
+    }
+    return TRUE;
+}
+
+scpi_bool_t scpi_instrument_input_end() {
+    scpi_stream.busy = true;
+    if (!scpi_stream.overrun && scpi_stream.len && !stream_macro(scpi_stream.len)) {
+        stream_dispatch_unit(scpi_stream.len);
+        stream_execute(scpi_stream.len);
+    }
+    if (!scpi_stream.clear_pending) {
+        stream_end_response();
+    }
+    scpi_stream.busy = false;
+    scpi_stream.clear_pending = false;
+    stream_reset();
+    return TRUE;
+}
+
+void scpi_instrument_input_clear() {
+    // a clear can arrive while a command that's being executed waits for USB
+    if (scpi_stream.busy) {
+        scpi_stream.clear_pending = true;
+    } else {
+        stream_reset();
+    }
 }
 
 scpi_interface_t scpi_interface = {
-    .error = NULL,            // haven't implemented an error logger
+    .error = SCPI_Error,
     .write = SCPI_Write,
     .control = SCPI_Control,
     .flush = NULL,            // don't need flush for SCI / USB
@@ -83,11 +527,26 @@ void scpi_instrument_init() {
              SCPI_IDN1, SCPI_IDN2, serial, SCPI_IDN4,
              scpi_input_buffer, SCPI_INPUT_BUFFER_LENGTH,
              scpi_error_queue_data, SCPI_ERROR_QUEUE_SIZE);
+     scpi_dispatch_init(scpi_commands);
+     scpi_trigger_init();
+     scpi_status_init();
+     scpi_format_reset();
 
 }
 
 
 
+/*
+ * The SCPI lib calls this function after it queued an error
+ */
+int SCPI_Error(scpi_t * context, int_fast16_t err) {
+    size_t count = (size_t) SCPI_ErrorCount(context);
+    scpi_memory_use(SCPI_MEMORY_ERROR, count * sizeof(scpi_error_t));
+    // a full queue ends with the overflow error instead of this one: the journal keeps it
+    scpi_log((count >= SCPI_ERROR_QUEUE_SIZE) ? SCPI_LOG_OVERFLOW : SCPI_LOG_ERROR, (int16_t) err);
+    return 0;
+}
+
 /*
  * The SCPI lib calls this function to write data back over the SCI2 interface
  * visual clue: dim user LED B after delivering the reply
@@ -95,13 +554,65 @@ void scpi_instrument_init() {
 size_t SCPI_Write(scpi_t * context, const char * data, size_t len) {
     (void) context;
 
+  if (instrument_capture != NULL) {
+    instrument_capture(data, len, instrument_capture_context);
+    return len;
+  }
+  // the line ending of a part of the message: the end of the message writes it
+  if (((len == 1u) && (data[0] == '\n')) || ((len == 2u) && (data[0] == '\r') && (data[1] == '\n'))) {
+    memcpy(scpi_stream.line_end, data, len);
+    scpi_stream.line_end_len = len;
+    return len;
+  }
+  if (scpi_stream.line_end_len) { // the response of the next part
+    scpi_stream.line_end_len = 0u;
+    setReply(";", 1u);
+  }
   setReply(data, len);
 
     return len;
 }
 
+/*
+ * Reply with a definite length block without copying it through the reply buffer:
+ * the header goes through the SCPI lib, the producer hands out the data when the host reads.
+ */
+size_t SCPI_ResultBlockProducer(scpi_t * context, size_t len, usbtmc_block_producer_t producer, void * producer_context) {
+    size_t result = SCPI_ResultArbitraryBlockHeader(context, len);
+    if (instrument_capture != NULL) { // the producer's data is only valid until its next call
+        size_t offset = 0u;
+        while (offset < len) {
+            const uint8_t * data;
+            size_t part = producer(producer_context, offset, len - offset, &data);
+            if (!part) {
+                break;
+            }
+            instrument_capture((const char *) data, part, instrument_capture_context);
+            offset += part;
+        }
+        return result + len;
+    }
+    setReplyBlock(len, producer, producer_context);
+    return result + len;
+}
+
 scpi_result_t SCPI_Reset(scpi_t * context) {
     (void) context;
+    scpi_operation_clear();
+    scpi_trigger_init();
+#if SCPI_ACQUIRE
+    scpi_acquire_reset();
+#endif
+#if SCPI_MACRO
+    scpi_macro_reset();
+#endif
+#if SCPI_SEQUENCE
+    scpi_sequence_reset();
+#endif
+#if SCPI_TRACE
+    scpi_trace_reset();
+#endif
+    scpi_format_reset();
     initInstrument();
     return SCPI_RES_OK;   
 }
@@ -0,0 +1,431 @@
+#include "scpi/scpi_dispatch.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+_Static_assert(((SCPI_DISPATCH_BUCKETS & (SCPI_DISPATCH_BUCKETS - 1)) == 0) && (SCPI_DISPATCH_BUCKETS <= 64),
+    "SCPI_DISPATCH_BUCKETS must be a power of 2, up to 64");
+_Static_assert(SCPI_DISPATCH_MAX_COMMANDS <= UINT16_MAX, "SCPI_DISPATCH_MAX_COMMANDS is too large");
+
+// patterns with an optional or short root keyword go in this bucket. It's always searched.
+#define DISPATCH_ANY SCPI_DISPATCH_BUCKETS
+// characters of the root keyword that make the key. Short and long form share them.
+#define DISPATCH_KEY_LENGTH 3
+
+static const scpi_command_t * dispatch_commands;
+static size_t dispatch_count;
+static bool dispatch_indexed;
+// open addressing hash table of root keys, each key has its own bucket
+static char dispatch_key[SCPI_DISPATCH_BUCKETS][DISPATCH_KEY_LENGTH];
+static bool dispatch_key_used[SCPI_DISPATCH_BUCKETS];
+// command numbers, grouped per bucket. Bucket b is dispatch_index[dispatch_start[b]] up to dispatch_start[b + 1]
+static uint16_t dispatch_index[SCPI_DISPATCH_MAX_COMMANDS];
+static uint16_t dispatch_start[SCPI_DISPATCH_BUCKETS + 2];
+
+// buckets used by the message that's being received
+static uint64_t dispatch_used;
+static bool dispatch_all;
+
+// recently matched headers (composed with their path, as received), most recent first
+typedef struct {
+    char header[SCPI_DISPATCH_CACHE_HEADER_LENGTH];
+    size_t len;         // 0: free
+    uint16_t command;
+} t_dispatch_cache;
+
+static t_dispatch_cache dispatch_cache[SCPI_DISPATCH_CACHE_SIZE];
+static uint32_t dispatch_cache_hits;
+static uint32_t dispatch_cache_misses;
+
+// units of the message that's being received, and their commands while they all hit the cache
+static size_t dispatch_units;
+static bool dispatch_cached;
+static uint16_t dispatch_hit[SCPI_DISPATCH_CACHE_SIZE];
+// header of the first unit, to learn its command
+static char dispatch_header[SCPI_DISPATCH_CACHE_HEADER_LENGTH];
+static size_t dispatch_header_len;
+
+// the command list that's handed to the lib, and the table numbers of its commands.
+// Resolved: it's the list of resolved units, not of the message that's being received
+static bool dispatch_resolved;
+static scpi_command_t dispatch_list[SCPI_DISPATCH_LIST_LENGTH + 1];
+static uint16_t dispatch_list_index[SCPI_DISPATCH_LIST_LENGTH];
+
+// bucket of a root key, or the free slot for it (insert). DISPATCH_ANY when it isn't there
+static unsigned int dispatch_bucket(const char * root, bool insert) {
+    char key[DISPATCH_KEY_LENGTH];
+    uint32_t h = 0u;
+    for (int i = 0; i < DISPATCH_KEY_LENGTH; i++) {
+        key[i] = (char) toupper((unsigned char) root[i]);
+        h = (h << 8) | (uint8_t) key[i];
+    }
+    h *= 2654435761u; // Knuth's multiplicative hash
+    unsigned int b = (unsigned int) (h >> 26) & (SCPI_DISPATCH_BUCKETS - 1);
+    for (int probe = 0; probe < SCPI_DISPATCH_BUCKETS; probe++) {
+        if (!dispatch_key_used[b]) {
+            if (!insert) {
+                break;
+            }
+            dispatch_key_used[b] = true;
+            memcpy(dispatch_key[b], key, sizeof(key));
+            return b;
+        }
+        if (!memcmp(dispatch_key[b], key, sizeof(key))) {
+            return b;
+        }
+        b = (b + 1u) & (SCPI_DISPATCH_BUCKETS - 1);
+    }
+    return DISPATCH_ANY;
+}
+
+// a pattern's root keyword in short form is its leading upper case part: SYSTem, *IDN?, MEASure#
+static bool pattern_root(const char * pattern, unsigned int * b) {
+    if (*pattern == ':') {
+        pattern++;
+    }
+    for (int i = 0; i < DISPATCH_KEY_LENGTH; i++) {
+        char c = pattern[i];
+        if (!(isupper((unsigned char) c) || isdigit((unsigned char) c) || (c == '*'))) {
+            *b = DISPATCH_ANY; // [optional] root, or a short form that's shorter than the key
+            return true;
+        }
+    }
+    *b = dispatch_bucket(pattern, true);
+    return *b != DISPATCH_ANY; // more root keywords than buckets
+}
+
+void scpi_dispatch_init(const scpi_command_t * commands) {
+    dispatch_commands = commands;
+    dispatch_count = 0u;
+    while (commands[dispatch_count].pattern != NULL) {
+        dispatch_count++;
+    }
+    memset(dispatch_cache, 0, sizeof(dispatch_cache));
+    scpi_dispatch_cache_reset();
+    scpi_dispatch_begin();
+
+    dispatch_indexed = false;
+    memset(dispatch_key_used, 0, sizeof(dispatch_key_used));
+    uint16_t count[SCPI_DISPATCH_BUCKETS + 1] = {0};
+    size_t n = 0;
+    unsigned int b;
+    for (; commands[n].pattern != NULL; n++) {
+        if ((n == SCPI_DISPATCH_MAX_COMMANDS) || !pattern_root(commands[n].pattern, &b)) {
+            return; // too large to index, the lib searches the whole table
+        }
+        count[b]++;
+    }
+    // counting sort: commands keep their table order within a bucket
+    uint16_t start = 0u;
+    for (int b = 0; b <= DISPATCH_ANY; b++) {
+        dispatch_start[b] = start;
+        start = (uint16_t) (start + count[b]);
+        count[b] = dispatch_start[b];
+    }
+    dispatch_start[DISPATCH_ANY + 1] = start;
+    for (size_t i = 0; i < n; i++) {
+        pattern_root(commands[i].pattern, &b);
+        dispatch_index[count[b]++] = (uint16_t) i;
+    }
+    dispatch_indexed = true;
+}
+
+void scpi_dispatch_begin() {
+    dispatch_used = 0u;
+    dispatch_all = false;
+    dispatch_units = 0u;
+    dispatch_cached = true;
+    dispatch_header_len = 0u;
+}
+
+static bool dispatch_cache_lookup(const char * header, size_t len, uint16_t * command) {
+    for (size_t i = 0u; i < SCPI_DISPATCH_CACHE_SIZE; i++) {
+        if ((dispatch_cache[i].len == len) && !memcmp(dispatch_cache[i].header, header, len)) {
+            t_dispatch_cache hit = dispatch_cache[i];
+            memmove(&dispatch_cache[1], &dispatch_cache[0], i * sizeof(t_dispatch_cache));
+            dispatch_cache[0] = hit;
+            *command = hit.command;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void dispatch_cache_learn(const char * header, size_t len, uint16_t command) {
+    memmove(&dispatch_cache[1], &dispatch_cache[0], (SCPI_DISPATCH_CACHE_SIZE - 1u) * sizeof(t_dispatch_cache));
+    memcpy(dispatch_cache[0].header, header, len);
+    dispatch_cache[0].len = len;
+    dispatch_cache[0].command = command;
+}
+
+// look the composed header up in the cache
+static void dispatch_unit_cache(const char * path, size_t path_len, const char * header, size_t header_len) {
+    size_t len = path_len + header_len;
+    char composed[SCPI_DISPATCH_CACHE_HEADER_LENGTH];
+    uint16_t command;
+    dispatch_units++;
+    if (len <= sizeof(composed)) {
+        memcpy(composed, path, path_len);
+        memcpy(composed + path_len, header, header_len);
+        if (dispatch_units == 1u) {
+            memcpy(dispatch_header, composed, len);
+            dispatch_header_len = len;
+        }
+        if (dispatch_cache_lookup(composed, len, &command)) {
+            if (dispatch_units <= SCPI_DISPATCH_CACHE_SIZE) {
+                dispatch_hit[dispatch_units - 1u] = command;
+            } else {
+                dispatch_cached = false;
+            }
+            return;
+        }
+    }
+    dispatch_cached = false;
+}
+
+void scpi_dispatch_unit(const char * path, size_t path_len, const char * header, size_t header_len) {
+    // the lib composes a relative header with the path of the previous one
+    bool relative = !((header[0] == '*') || (header[0] == ':') || !path_len);
+    dispatch_unit_cache(path, relative ? path_len : 0u, header, header_len);
+
+    const char * root = relative ? path : header;
+    size_t len = (root == header) ? header_len : path_len;
+    if (*root == ':') {
+        root++;
+        len--;
+    }
+    for (size_t i = 0; i < DISPATCH_KEY_LENGTH; i++) {
+        if ((i == len) || (root[i] == ':') || (root[i] == '?')) {
+            return; // short root keyword: only the DISPATCH_ANY bucket can match
+        }
+    }
+    unsigned int b = dispatch_bucket(root, false);
+    if (b != DISPATCH_ANY) { // else no command has this root
+        dispatch_used |= (uint64_t) 1u << b;
+    }
+}
+
+void scpi_dispatch_unknown() {
+    dispatch_all = true;
+    dispatch_cached = false;
+    dispatch_header_len = 0u;
+}
+
+// add the commands of a bucket to list, in table order: the lib takes the first pattern that matches
+static size_t dispatch_collect(const uint16_t * commands, size_t count, size_t len) {
+    for (size_t i = 0u; i < count; i++) {
+        if (len == SCPI_DISPATCH_LIST_LENGTH) {
+            return len + 1u;
+        }
+        size_t pos = len++;
+        while ((pos > 0u) && (dispatch_list_index[pos - 1u] > commands[i])) {
+            dispatch_list_index[pos] = dispatch_list_index[pos - 1u];
+            pos--;
+        }
+        dispatch_list_index[pos] = commands[i];
+    }
+    return len;
+}
+
+static size_t dispatch_collect_bucket(unsigned int b, size_t len) {
+    return dispatch_collect(&dispatch_index[dispatch_start[b]], (size_t) (dispatch_start[b + 1] - dispatch_start[b]), len);
+}
+
+void scpi_dispatch_select(scpi_t * context) {
+    context->param_list.cmd = NULL;
+    size_t len;
+    // the cache only serves a message when all of its headers are in there: count its units once, here
+    if (dispatch_cached && dispatch_units) {
+        // every unit's header was matched before: only those commands
+        dispatch_cache_hits += (uint32_t) dispatch_units;
+        len = dispatch_collect(dispatch_hit, dispatch_units, 0u);
+    } else {
+        dispatch_cache_misses += (uint32_t) dispatch_units;
+        if (!dispatch_indexed || dispatch_all) {
+            return;
+        }
+        len = dispatch_collect_bucket(DISPATCH_ANY, 0u);
+        for (unsigned int b = 0u; (b < SCPI_DISPATCH_BUCKETS) && (len <= SCPI_DISPATCH_LIST_LENGTH); b++) {
+            if (dispatch_used & ((uint64_t) 1u << b)) {
+                len = dispatch_collect_bucket(b, len);
+            }
+        }
+        if (len > SCPI_DISPATCH_LIST_LENGTH) {
+            return; // many subsystems in one message: full table
+        }
+    }
+    for (size_t i = 0u; i < len; i++) {
+        dispatch_list[i] = dispatch_commands[dispatch_list_index[i]];
+    }
+    dispatch_list[len].pattern = NULL;
+    context->cmdlist = dispatch_list;
+}
+
+// end of the program message unit that starts at i: ';' outside strings and blocks
+static size_t dispatch_unit_end(const char * units, size_t len, size_t i) {
+    char quote = '\0';
+    while (i < len) {
+        char c = units[i];
+        if (quote) {
+            if (c == quote) {
+                quote = '\0';
+            }
+        } else if ((c == '"') || (c == '\'')) {
+            quote = c;
+        } else if ((c == '#') && (i + 1u < len) && isdigit((unsigned char) units[i + 1u])) {
+            size_t digits = (size_t) (units[i + 1u] - '0');
+            if (!digits) { // indefinite length block, up to the end
+                return len;
+            }
+            size_t block = 0u;
+            for (size_t d = 0u; (d < digits) && (i + 2u + d < len); d++) {
+                block = (block * 10u) + (size_t) (units[i + 2u + d] - '0');
+            }
+            i += 2u + digits + block;
+            continue;
+        } else if ((c == ';') || (c == '\n')) {
+            return i;
+        }
+        i++;
+    }
+    return len;
+}
+
+static bool dispatch_put(char * out, size_t * pos, size_t max, const char * data, size_t len) {
+    if (*pos + len > max) {
+        return false;
+    }
+    memcpy(&out[*pos], data, len);
+    *pos += len;
+    return true;
+}
+
+bool scpi_dispatch_resolve(const char * units, size_t len, char * out, size_t * out_len,
+        uint16_t * commands, size_t * count, int16_t * error) {
+    char path[SCPI_DISPATCH_RESOLVE_HEADER_LENGTH];
+    size_t path_len = 0u;
+    size_t pos = 0u;
+    size_t max_commands = *count;
+    *count = 0u;
+    *error = SCPI_ERROR_EXECUTION_ERROR; // out of room
+    for (size_t i = 0u; i < len; i++) {
+        size_t end = dispatch_unit_end(units, len, i);
+        while ((i < end) && isspace((unsigned char) units[i])) {
+            i++;
+        }
+        size_t header = i;
+        while ((i < end) && !isspace((unsigned char) units[i])) {
+            i++;
+        }
+        size_t header_len = i - header;
+        while ((i < end) && isspace((unsigned char) units[i])) {
+            i++;
+        }
+        size_t params = i;
+        size_t params_len = end - i;
+        while (params_len && isspace((unsigned char) units[params + params_len - 1u])) {
+            params_len--;
+        }
+        i = end;
+        if (!header_len) {
+            continue;
+        }
+
+        // compose like the lib: a relative header goes after the path of the one before
+        char composed[SCPI_DISPATCH_RESOLVE_HEADER_LENGTH];
+        if (units[header] == '*') { // common command: the next one starts from the root
+            path_len = 0u;
+        } else if (units[header] == ':') {
+            path_len = 0u;
+            header++;
+            header_len--;
+        }
+        if ((path_len + header_len > sizeof(composed)) || (*count == max_commands)) {
+            return false;
+        }
+        memcpy(composed, path, path_len);
+        memcpy(&composed[path_len], &units[header], header_len);
+        size_t composed_len = path_len + header_len;
+        if (composed[0] != '*') {
+            path_len = composed_len;
+            while (path_len && (composed[path_len - 1u] != ':')) {
+                path_len--;
+            }
+            memcpy(path, composed, path_len);
+        }
+
+        size_t command = 0u;
+        while ((command < dispatch_count) && !SCPI_Match(dispatch_commands[command].pattern, composed, composed_len)) {
+            command++;
+        }
+        if ((command == dispatch_count) || (command > UINT16_MAX)) {
+            *error = SCPI_ERROR_UNDEFINED_HEADER;
+            return false;
+        }
+        commands[(*count)++] = (uint16_t) command;
+
+        bool fits = (!pos || dispatch_put(out, &pos, *out_len, ";", 1u))
+                && ((composed[0] == '*') || dispatch_put(out, &pos, *out_len, ":", 1u))
+                && dispatch_put(out, &pos, *out_len, composed, composed_len)
+                && (!params_len || (dispatch_put(out, &pos, *out_len, " ", 1u)
+                    && dispatch_put(out, &pos, *out_len, &units[params], params_len)));
+        if (!fits) {
+            return false;
+        }
+    }
+    *out_len = pos;
+    return true;
+}
+
+void scpi_dispatch_select_commands(scpi_t * context, const uint16_t * commands, size_t count) {
+    context->param_list.cmd = NULL;
+    dispatch_resolved = true;
+    size_t len = dispatch_collect(commands, count, 0u);
+    if (len > SCPI_DISPATCH_LIST_LENGTH) {
+        return;
+    }
+    for (size_t i = 0u; i < len; i++) {
+        dispatch_list[i] = dispatch_commands[dispatch_list_index[i]];
+    }
+    dispatch_list[len].pattern = NULL;
+    context->cmdlist = dispatch_list;
+}
+
+bool scpi_dispatch_matched(const scpi_t * context, uint16_t * command) {
+    const scpi_command_t * cmd = context->param_list.cmd;
+    if (cmd == NULL) {
+        return false;
+    }
+    if ((cmd >= dispatch_list) && (cmd < &dispatch_list[SCPI_DISPATCH_LIST_LENGTH])) {
+        *command = dispatch_list_index[cmd - dispatch_list];
+        return true;
+    }
+    if ((cmd >= dispatch_commands) && (cmd < &dispatch_commands[dispatch_count]) && (dispatch_count <= UINT16_MAX)) {
+        *command = (uint16_t) (cmd - dispatch_commands);
+        return true;
+    }
+    return false;
+}
+
+void scpi_dispatch_restore(scpi_t * context) {
+    // a message with one unit: the command that the lib matched is the one for its header
+    uint16_t command;
+    bool resolved = dispatch_resolved;
+    dispatch_resolved = false;
+    if (!resolved && (dispatch_units == 1u) && !dispatch_cached && dispatch_header_len && scpi_dispatch_matched(context, &command)) {
+        dispatch_cache_learn(dispatch_header, dispatch_header_len, command);
+    }
+    context->cmdlist = dispatch_commands;
+}
+
+void scpi_dispatch_cache_stats(uint32_t * hits, uint32_t * misses) {
+    *hits = dispatch_cache_hits;
+    *misses = dispatch_cache_misses;
+}
+
+void scpi_dispatch_cache_reset() {
+    dispatch_cache_hits = 0u;
+    dispatch_cache_misses = 0u;
+}
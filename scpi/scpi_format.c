@@ -0,0 +1,416 @@
+#include "scpi/scpi_format.h"
+#include "scpi/scpi_base.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+typedef enum {
+    FORMAT_ASCII,
+    FORMAT_REAL,
+    FORMAT_INTEGER,
+} t_format_type;
+
+static const scpi_choice_def_t format_type_choice[] = {
+    {"ASCii", FORMAT_ASCII},
+    {"REAL", FORMAT_REAL},
+    {"INTeger", FORMAT_INTEGER},
+    SCPI_CHOICE_LIST_END
+};
+
+static const scpi_choice_def_t format_border_choice[] = {
+    {"NORMal", 0},
+    {"SWAPped", 1},
+    SCPI_CHOICE_LIST_END
+};
+
+typedef enum {
+    SOURCE_INT16,
+    SOURCE_INT32,
+    SOURCE_FLOAT,
+} t_format_source;
+
+static t_format_type format_type;
+static unsigned int format_length;  // bytes per value of a binary format
+static bool format_swapped;         // least significant byte first
+static bool format_first;           // no value of the current result written yet
+
+// SWAPped is the order the values already have in memory
+#define FORMAT_NATIVE_SWAPPED (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+// results are converted in parts of this size
+#define FORMAT_CHUNK 128u
+// longest number in ASCii: -0.00001234567
+#define FORMAT_NUMBER_LENGTH 16u
+
+void scpi_format_reset() {
+    format_type = FORMAT_ASCII;
+    format_length = 4u;
+    format_swapped = false;
+}
+
+static size_t format_int(char * out, int32_t value) {
+    char digits[10];
+    uint32_t u = (value < 0) ? (0u - (uint32_t) value) : (uint32_t) value;
+    size_t n = 0u;
+    do {
+        digits[n++] = (char) ('0' + (u % 10u));
+        u /= 10u;
+    } while (u);
+    size_t len = 0u;
+    if (value < 0) {
+        out[len++] = '-';
+    }
+    while (n) {
+        out[len++] = digits[--n];
+    }
+    return len;
+}
+
+// 7 significant digits, like %g: fixed notation from 1E-5 up to 1E+7, else scientific
+static size_t format_float(char * out, float value) {
+    if (isnan(value)) {
+        memcpy(out, "9.91E+37", 8); // SCPI std V1999.0 7.2.1.5
+        return 8u;
+    }
+    size_t len = 0u;
+    if (signbit(value)) {
+        out[len++] = '-';
+    }
+    if (isinf(value)) {
+        memcpy(&out[len], "9.9E+37", 7);
+        return len + 7u;
+    }
+    double v = fabs((double) value);
+    if (v == 0.0) {
+        out[0] = '0'; // no -0
+        return 1u;
+    }
+    int e = 0;
+    while (v >= 1e8) {
+        v *= 1e-8;
+        e += 8;
+    }
+    while (v >= 10.0) {
+        v *= 0.1;
+        e++;
+    }
+    while (v < 1e-7) {
+        v *= 1e8;
+        e -= 8;
+    }
+    while (v < 1.0) {
+        v *= 10.0;
+        e--;
+    }
+    uint32_t m = (uint32_t) ((v * 1e6) + 0.5);
+    if (m >= 10000000u) { // rounded up to the next power of 10
+        m = 1000000u;
+        e++;
+    }
+    char d[7];
+    for (int i = 6; i >= 0; i--) {
+        d[i] = (char) ('0' + (m % 10u));
+        m /= 10u;
+    }
+    int digits = 7;
+    while ((digits > 1) && (d[digits - 1] == '0')) {
+        digits--;
+    }
+
+    if ((e >= -5) && (e < 7)) {
+        if (e < 0) {
+            out[len++] = '0';
+            out[len++] = '.';
+            for (int i = -1; i > e; i--) {
+                out[len++] = '0';
+            }
+            memcpy(&out[len], d, (size_t) digits);
+            return len + (size_t) digits;
+        }
+        for (int i = 0; i <= e; i++) {
+            out[len++] = (i < digits) ? d[i] : '0';
+        }
+        if (digits > e + 1) {
+            out[len++] = '.';
+            memcpy(&out[len], &d[e + 1], (size_t) (digits - e - 1));
+            len += (size_t) (digits - e - 1);
+        }
+        return len;
+    }
+    out[len++] = d[0];
+    if (digits > 1) {
+        out[len++] = '.';
+        memcpy(&out[len], &d[1], (size_t) (digits - 1));
+        len += (size_t) (digits - 1);
+    }
+    out[len++] = 'E';
+    out[len++] = (e < 0) ? '-' : '+';
+    if (e < 0) {
+        e = -e;
+    }
+    out[len++] = (char) ('0' + (e / 10));
+    out[len++] = (char) ('0' + (e % 10));
+    return len;
+}
+
+static size_t format_ascii_value(char * out, const void * data, size_t i, t_format_source source) {
+    switch (source) {
+    case SOURCE_INT16:
+        return format_int(out, ((const int16_t *) data)[i]);
+    case SOURCE_INT32:
+        return format_int(out, ((const int32_t *) data)[i]);
+    default:
+        return format_float(out, ((const float *) data)[i]);
+    }
+}
+
+// comma separated values, after format_begin()
+static size_t format_ascii(scpi_t * context, const void * data, size_t count, t_format_source source) {
+    char chunk[FORMAT_CHUNK];
+    size_t fill = 0u;
+    size_t written = 0u;
+    for (size_t i = 0u; i < count; i++) {
+        if (fill + FORMAT_NUMBER_LENGTH + 1u > sizeof(chunk)) {
+            written += context->interface->write(context, chunk, fill);
+            fill = 0u;
+        }
+        if (i || !format_first) {
+            chunk[fill++] = ',';
+        }
+        fill += format_ascii_value(&chunk[fill], data, i, source);
+    }
+    if (fill) {
+        written += context->interface->write(context, chunk, fill);
+    }
+    if (count) {
+        format_first = false;
+    }
+    return written;
+}
+
+static int32_t format_round(float value, int32_t min, int32_t max) {
+    if (isnan(value)) {
+        return 0;
+    }
+    if (value <= (float) min) {
+        return min;
+    }
+    if (value >= (float) max) {
+        return max;
+    }
+    return (int32_t) ((value < 0.0f) ? (value - 0.5f) : (value + 0.5f));
+}
+
+// value i of data, as the bits of the selected binary type
+static uint32_t format_bits(const void * data, size_t i, t_format_source source) {
+    if (format_type == FORMAT_REAL) {
+        float f;
+        switch (source) {
+        case SOURCE_INT16:
+            f = (float) ((const int16_t *) data)[i];
+            break;
+        case SOURCE_INT32:
+            f = (float) ((const int32_t *) data)[i];
+            break;
+        default:
+            f = ((const float *) data)[i];
+            break;
+        }
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        return bits;
+    }
+    int32_t min = (format_length == 2u) ? INT16_MIN : INT32_MIN;
+    int32_t max = (format_length == 2u) ? INT16_MAX : INT32_MAX;
+    int32_t v;
+    switch (source) {
+    case SOURCE_INT16:
+        v = ((const int16_t *) data)[i];
+        break;
+    case SOURCE_INT32:
+        v = ((const int32_t *) data)[i];
+        v = (v < min) ? min : ((v > max) ? max : v);
+        break;
+    default:
+        v = format_round(((const float *) data)[i], min, max);
+        break;
+    }
+    return (uint32_t) v;
+}
+
+// the values are already in the selected type and byte order: send them as they are
+static bool format_native(t_format_source source) {
+    if (format_swapped != FORMAT_NATIVE_SWAPPED) {
+        return false;
+    }
+    switch (source) {
+    case SOURCE_INT16:
+        return (format_type == FORMAT_INTEGER) && (format_length == 2u);
+    case SOURCE_INT32:
+        return (format_type == FORMAT_INTEGER) && (format_length == 4u);
+    default:
+        return format_type == FORMAT_REAL;
+    }
+}
+
+// start a result of count values. ASCii: the separator from the previous result goes through the lib
+static size_t format_begin(scpi_t * context, size_t count) {
+    format_first = true;
+    if (format_type == FORMAT_ASCII) {
+        return SCPI_ResultCharacters(context, "", 0u);
+    }
+    return SCPI_ResultArbitraryBlockHeader(context, count * format_length);
+}
+
+static size_t format_part(scpi_t * context, const void * data, size_t count, t_format_source source) {
+    if (format_type == FORMAT_ASCII) {
+        return format_ascii(context, data, count, source);
+    }
+    if (format_native(source)) {
+        return SCPI_ResultArbitraryBlockData(context, data, count * format_length);
+    }
+    uint8_t chunk[FORMAT_CHUNK];
+    size_t fill = 0u;
+    size_t written = 0u;
+    for (size_t i = 0u; i < count; i++) {
+        uint32_t bits = format_bits(data, i, source);
+        for (unsigned int b = 0u; b < format_length; b++) {
+            unsigned int shift = 8u * (format_swapped ? b : (format_length - 1u - b));
+            chunk[fill++] = (uint8_t) (bits >> shift);
+        }
+        if (fill + format_length > sizeof(chunk)) {
+            written += SCPI_ResultArbitraryBlockData(context, chunk, fill);
+            fill = 0u;
+        }
+    }
+    if (fill) {
+        written += SCPI_ResultArbitraryBlockData(context, chunk, fill);
+    }
+    return written;
+}
+
+static size_t format_result(scpi_t * context, const void * data, size_t count, t_format_source source) {
+    return format_begin(context, count) + format_part(context, data, count, source);
+}
+
+static size_t format_static_producer(void * context, size_t offset, size_t max, const uint8_t ** data) {
+    *data = (const uint8_t *) context + offset;
+    return max;
+}
+
+// binary values that already have the selected type and byte order are sent from data when the host reads
+static size_t format_result_static(scpi_t * context, const void * data, size_t count, t_format_source source) {
+    if ((format_type == FORMAT_ASCII) || !format_native(source)) {
+        return format_result(context, data, count, source);
+    }
+    return SCPI_ResultBlockProducer(context, count * format_length, format_static_producer, (void *) data);
+}
+
+bool scpi_format_static_pending(const void ** data, size_t * len) {
+    void * context;
+    if (!usbtmc_app_block_pending(format_static_producer, &context, len)) {
+        return false;
+    }
+    *data = context;
+    return true;
+}
+
+size_t SCPI_ResultDataInt32(scpi_t * context, int32_t value) {
+    return format_result(context, &value, 1u, SOURCE_INT32);
+}
+
+size_t SCPI_ResultDataFloat(scpi_t * context, float value) {
+    return format_result(context, &value, 1u, SOURCE_FLOAT);
+}
+
+size_t SCPI_ResultDataArrayInt16(scpi_t * context, const int16_t * data, size_t count) {
+    return format_result(context, data, count, SOURCE_INT16);
+}
+
+size_t SCPI_ResultDataArrayInt32(scpi_t * context, const int32_t * data, size_t count) {
+    return format_result(context, data, count, SOURCE_INT32);
+}
+
+size_t SCPI_ResultDataArrayFloat(scpi_t * context, const float * data, size_t count) {
+    return format_result(context, data, count, SOURCE_FLOAT);
+}
+
+size_t SCPI_ResultDataArrayFloatStatic(scpi_t * context, const float * data, size_t count) {
+    return format_result_static(context, data, count, SOURCE_FLOAT);
+}
+
+size_t SCPI_ResultDataArrayBegin(scpi_t * context, size_t count) {
+    return format_begin(context, count);
+}
+
+size_t SCPI_ResultDataArrayInt16Part(scpi_t * context, const int16_t * data, size_t count) {
+    return format_part(context, data, count, SOURCE_INT16);
+}
+
+size_t SCPI_ResultDataArrayInt32Part(scpi_t * context, const int32_t * data, size_t count) {
+    return format_part(context, data, count, SOURCE_INT32);
+}
+
+size_t SCPI_ResultDataArrayFloatPart(scpi_t * context, const float * data, size_t count) {
+    return format_part(context, data, count, SOURCE_FLOAT);
+}
+
+/**
+ * FORMat[:DATA] ASCii|REAL[,32]|INTeger[,16|32] - format of numeric results. INTeger without length: 32
+ */
+scpi_result_t SCPI_FormatData(scpi_t * context) {
+    int32_t type;
+    int32_t length = 0;
+    if (!SCPI_ParamChoice(context, format_type_choice, &type, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    bool has_length = SCPI_ParamInt32(context, &length, FALSE);
+    if (type == FORMAT_ASCII) {
+        format_type = FORMAT_ASCII;
+        return SCPI_RES_OK;
+    }
+    if (!has_length) {
+        length = 32;
+    }
+    if (!((length == 32) || ((type == FORMAT_INTEGER) && (length == 16)))) {
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+        return SCPI_RES_ERR;
+    }
+    format_type = (t_format_type) type;
+    format_length = (unsigned int) length / 8u;
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_FormatDataQ(scpi_t * context) {
+    switch (format_type) {
+    case FORMAT_ASCII:
+        SCPI_ResultMnemonic(context, "ASC");
+        break;
+    case FORMAT_REAL:
+        SCPI_ResultMnemonic(context, "REAL");
+        SCPI_ResultInt32(context, (int32_t) format_length * 8);
+        break;
+    default:
+        SCPI_ResultMnemonic(context, "INT");
+        SCPI_ResultInt32(context, (int32_t) format_length * 8);
+        break;
+    }
+    return SCPI_RES_OK;
+}
+
+/**
+ * FORMat:BORDer NORMal|SWAPped - byte order of binary results. NORMal: most significant byte first
+ */
+scpi_result_t SCPI_FormatBorder(scpi_t * context) {
+    int32_t border;
+    if (!SCPI_ParamChoice(context, format_border_choice, &border, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    format_swapped = border != 0;
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_FormatBorderQ(scpi_t * context) {
+    SCPI_ResultMnemonic(context, format_swapped ? "SWAP" : "NORM");
+    return SCPI_RES_OK;
+}
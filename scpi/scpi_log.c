@@ -0,0 +1,101 @@
+#include "scpi/scpi_log.h"
+
+#include "scpi/scpi_base.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+
+_Static_assert((SCPI_LOG_DEPTH & (SCPI_LOG_DEPTH - 1u)) == 0u, "SCPI_LOG_DEPTH must be a power of 2");
+
+static scpi_log_entry_t log_ring[SCPI_LOG_RINGS][SCPI_LOG_DEPTH];
+// free running counters, the position in the ring is counter % depth
+static volatile uint32_t log_head[SCPI_LOG_RINGS];  // the ring's core
+static uint32_t log_read[SCPI_LOG_RINGS];           // SYSTem:LOG?
+
+#define LOG_NAME(id, name) [SCPI_LOG_##id] = name,
+static const char * const log_name[SCPI_LOG_EVENT_COUNT] = {
+    SCPI_LOG_EVENTS(LOG_NAME)
+};
+#undef LOG_NAME
+
+void scpi_log(scpi_log_event_t event, int16_t code) {
+#if USBTMC_APP_DUAL_CORE
+    uint32_t ring = get_core_num();
+#else
+    uint32_t ring = 0u;
+#endif
+    uint32_t index = log_head[ring];
+    scpi_log_entry_t * entry = &log_ring[ring][index & (SCPI_LOG_DEPTH - 1u)];
+    entry->sequence = 0u; // a reader that copies it now drops it
+    __dmb();
+    entry->time = time_us_64();
+    entry->event = (uint8_t) event;
+    entry->code = code;
+    __dmb();
+    entry->sequence = index + 1u;
+    log_head[ring] = index + 1u;
+
+    uint32_t held = 0u;
+    for (uint32_t i = 0u; i < SCPI_LOG_RINGS; i++) {
+        uint32_t fill = log_head[i] - log_read[i];
+        held += (fill < SCPI_LOG_DEPTH) ? fill : SCPI_LOG_DEPTH;
+    }
+    scpi_memory_use(SCPI_MEMORY_LOG, held * sizeof(scpi_log_entry_t));
+}
+
+// copy the ring's next entry. False when it was overwritten
+static bool log_copy(uint32_t ring, scpi_log_entry_t * copy) {
+    const scpi_log_entry_t * entry = &log_ring[ring][log_read[ring] & (SCPI_LOG_DEPTH - 1u)];
+    uint32_t sequence = entry->sequence;
+    __dmb();
+    copy->time = entry->time;
+    copy->event = entry->event;
+    copy->code = entry->code;
+    __dmb();
+    return (sequence == log_read[ring] + 1u) && (entry->sequence == sequence);
+}
+
+/**
+ * SYSTem:LOG? - drain the journal: the entries lost since the last SYSTem:LOG?, then for each
+ * entry, oldest first: time in us, event (ERR, OVFL, CLR, ABIN, ABOUT, TRG) and error number
+ */
+scpi_result_t SCPI_SystemLogQ(scpi_t * context) {
+    uint32_t head[SCPI_LOG_RINGS];
+    uint32_t lost = 0u;
+    for (uint32_t i = 0u; i < SCPI_LOG_RINGS; i++) {
+        head[i] = log_head[i];
+        if (head[i] - log_read[i] > SCPI_LOG_DEPTH) {
+            lost += head[i] - log_read[i] - SCPI_LOG_DEPTH;
+            log_read[i] = head[i] - SCPI_LOG_DEPTH;
+        }
+    }
+    __dmb(); // entries before head
+    SCPI_ResultUInt32(context, lost);
+
+    // the rings are in time order each, merge them
+    scpi_log_entry_t next[SCPI_LOG_RINGS];
+    bool valid[SCPI_LOG_RINGS] = { false };
+    for (;;) {
+        uint32_t oldest = SCPI_LOG_RINGS;
+        for (uint32_t i = 0u; i < SCPI_LOG_RINGS; i++) {
+            while (!valid[i] && (log_read[i] != head[i])) {
+                valid[i] = log_copy(i, &next[i]);
+                if (!valid[i]) { // the writer went round while this reply was written
+                    log_read[i]++;
+                    lost++;
+                }
+            }
+            if (valid[i] && ((oldest == SCPI_LOG_RINGS) || (next[i].time < next[oldest].time))) {
+                oldest = i;
+            }
+        }
+        if (oldest == SCPI_LOG_RINGS) {
+            break;
+        }
+        SCPI_ResultUInt64(context, next[oldest].time);
+        SCPI_ResultMnemonic(context, (next[oldest].event < SCPI_LOG_EVENT_COUNT) ? log_name[next[oldest].event] : "?");
+        SCPI_ResultInt32(context, next[oldest].code);
+        valid[oldest] = false;
+        log_read[oldest]++;
+    }
+    return SCPI_RES_OK;
+}
@@ -0,0 +1,233 @@
+#include "scpi/scpi_macro.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+#include "scpi/scpi_base.h"
+#include "scpi/scpi_dispatch.h"
+
+typedef struct {
+    char label[SCPI_MACRO_LABEL_LENGTH + 1u];
+    size_t label_len;       // 0: free
+    // in the arena: the body as defined, followed by the resolved units and a '\0'
+    size_t body;
+    size_t body_len;
+    size_t resolved_len;
+    uint16_t commands[SCPI_MACRO_UNITS];
+    size_t count;
+} t_macro;
+
+static t_macro macros[SCPI_MACRO_COUNT];
+static char macro_arena[SCPI_MACRO_ARENA];
+static size_t macro_arena_used;
+static bool macro_enabled;
+static bool macro_busy;
+
+void scpi_macro_reset() {
+    macro_enabled = false;
+}
+
+// macro with this label, enabled or not. SCPI_MACRO_COUNT: none
+static unsigned int macro_lookup(const char * label, size_t len) {
+    for (unsigned int i = 0u; i < SCPI_MACRO_COUNT; i++) {
+        if ((macros[i].label_len == len) && !strncasecmp(macros[i].label, label, len)) {
+            return i;
+        }
+    }
+    return SCPI_MACRO_COUNT;
+}
+
+static unsigned int macro_free_slot() {
+    unsigned int i = 0u;
+    while ((i < SCPI_MACRO_COUNT) && macros[i].label_len) {
+        i++;
+    }
+    return i;
+}
+
+bool scpi_macro_find(const char * header, size_t len, unsigned int * macro) {
+    if (!macro_enabled || !len) {
+        return false;
+    }
+    *macro = macro_lookup(header, len);
+    return *macro < SCPI_MACRO_COUNT;
+}
+
+void scpi_macro_get(unsigned int macro, const char ** body, size_t * len, const uint16_t ** commands, size_t * count) {
+    const t_macro * m = &macros[macro];
+    *body = &macro_arena[m->body + m->body_len];
+    *len = m->resolved_len;
+    *commands = m->commands;
+    *count = m->count;
+}
+
+void scpi_macro_running(bool running) {
+    macro_busy = running;
+}
+
+static void macro_remove(unsigned int macro) {
+    t_macro * m = &macros[macro];
+    size_t start = m->body;
+    size_t size = m->body_len + m->resolved_len + 1u;
+    memmove(&macro_arena[start], &macro_arena[start + size], macro_arena_used - (start + size));
+    macro_arena_used -= size;
+    for (unsigned int i = 0u; i < SCPI_MACRO_COUNT; i++) {
+        if (macros[i].label_len && (macros[i].body > start)) {
+            macros[i].body -= size;
+        }
+    }
+    m->label_len = 0u;
+}
+
+static bool macro_label_valid(const char * label, size_t len) {
+    if (!len || (len > SCPI_MACRO_LABEL_LENGTH)) {
+        return false;
+    }
+    for (size_t i = 0u; i < len; i++) {
+        char c = label[i];
+        if (!(isalnum((unsigned char) c) || (c == '_') || (c == ':') || (c == '*') || (c == '?'))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool macro_changeable(scpi_t * context) {
+    if (macro_busy) { // a body doesn't change the macros
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * *DMC <label>,<body> - define a macro. The body is a string or a definite length block
+ *      with program message units, separated by ';'
+ */
+scpi_result_t SCPI_CoreDmc(scpi_t * context) {
+    const char * label;
+    size_t label_len;
+    const char * body;
+    size_t body_len;
+    if (!SCPI_ParamCharacters(context, &label, &label_len, TRUE)
+            || !SCPI_ParamCharacters(context, &body, &body_len, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    if (!macro_changeable(context)) {
+        return SCPI_RES_ERR;
+    }
+    if (!macro_label_valid(label, label_len) || (macro_lookup(label, label_len) < SCPI_MACRO_COUNT)) {
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+        return SCPI_RES_ERR;
+    }
+    unsigned int slot = macro_free_slot();
+    size_t free = SCPI_MACRO_ARENA - macro_arena_used;
+    if ((slot == SCPI_MACRO_COUNT) || (body_len + 1u > free)) {
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return SCPI_RES_ERR;
+    }
+    t_macro * m = &macros[slot];
+    char * at = &macro_arena[macro_arena_used];
+    memcpy(at, body, body_len);
+    size_t resolved_len = free - body_len - 1u;
+    size_t count = SCPI_MACRO_UNITS;
+    int16_t error;
+    if (!scpi_dispatch_resolve(at, body_len, &at[body_len], &resolved_len, m->commands, &count, &error)) {
+        SCPI_ErrorPush(context, error);
+        return SCPI_RES_ERR;
+    }
+    m->resolved_len = resolved_len;
+    m->count = count;
+    at[body_len + m->resolved_len] = '\0';
+    m->body = macro_arena_used;
+    m->body_len = body_len;
+    memcpy(m->label, label, label_len);
+    m->label[label_len] = '\0';
+    m->label_len = label_len;
+    macro_arena_used += body_len + m->resolved_len + 1u;
+    scpi_memory_use(SCPI_MEMORY_MACRO, macro_arena_used);
+    return SCPI_RES_OK;
+}
+
+/**
+ * *EMC <0|1> - disable or enable macros. *RST: 0
+ */
+scpi_result_t SCPI_CoreEmc(scpi_t * context) {
+    int32_t enable;
+    if (!SCPI_ParamInt32(context, &enable, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    macro_enabled = (enable != 0);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_CoreEmcQ(scpi_t * context) {
+    SCPI_ResultInt32(context, macro_enabled ? 1 : 0);
+    return SCPI_RES_OK;
+}
+
+/**
+ * *GMC? <label> - body of the macro, as it was defined, in a definite length block
+ */
+scpi_result_t SCPI_CoreGmcQ(scpi_t * context) {
+    const char * label;
+    size_t label_len;
+    if (!SCPI_ParamCharacters(context, &label, &label_len, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    unsigned int macro = macro_lookup(label, label_len);
+    if (!label_len || (macro == SCPI_MACRO_COUNT)) {
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+        return SCPI_RES_ERR;
+    }
+    SCPI_ResultArbitraryBlock(context, &macro_arena[macros[macro].body], macros[macro].body_len);
+    return SCPI_RES_OK;
+}
+
+/**
+ * *LMC? - labels of the defined macros. An empty string when there are none
+ */
+scpi_result_t SCPI_CoreLmcQ(scpi_t * context) {
+    bool any = false;
+    for (unsigned int i = 0u; i < SCPI_MACRO_COUNT; i++) {
+        if (macros[i].label_len) {
+            SCPI_ResultText(context, macros[i].label);
+            any = true;
+        }
+    }
+    if (!any) {
+        SCPI_ResultText(context, "");
+    }
+    return SCPI_RES_OK;
+}
+
+/**
+ * *PMC - delete all macros
+ * *RMC <label> - delete one macro
+ */
+scpi_result_t SCPI_CorePmc(scpi_t * context) {
+    if (!macro_changeable(context)) {
+        return SCPI_RES_ERR;
+    }
+    for (unsigned int i = 0u; i < SCPI_MACRO_COUNT; i++) {
+        macros[i].label_len = 0u;
+    }
+    macro_arena_used = 0u;
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_CoreRmc(scpi_t * context) {
+    const char * label;
+    size_t label_len;
+    if (!SCPI_ParamCharacters(context, &label, &label_len, TRUE) || !macro_changeable(context)) {
+        return SCPI_RES_ERR;
+    }
+    unsigned int macro = macro_lookup(label, label_len);
+    if (!label_len || (macro == SCPI_MACRO_COUNT)) {
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+        return SCPI_RES_ERR;
+    }
+    macro_remove(macro);
+    return SCPI_RES_OK;
+}
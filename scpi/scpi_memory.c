@@ -0,0 +1,83 @@
+#include "scpi/scpi_memory.h"
+
+#include "scpi/scpi_base.h"
+
+// bytes of each region. The Bulk-OUT queue counts its packet data
+#define MEMORY_SIZE_INPUT SCPI_INPUT_BUFFER_LENGTH
+#define MEMORY_SIZE_ERROR (SCPI_ERROR_QUEUE_SIZE * sizeof(scpi_error_t))
+#define MEMORY_SIZE_RX (USBTMC_RX_QUEUE_DEPTH * USBTMC_BULK_PACKET_SIZE)
+#define MEMORY_SIZE_REPLY USBTMC_REPLY_BUFFER_SIZE
+// regions of optional subsystems that aren't built take nothing
+#if SCPI_ACQUIRE
+#define MEMORY_SIZE_ACQUIRE (SCPI_ACQUIRE_DEPTH * sizeof(int16_t))
+#else
+#define MEMORY_SIZE_ACQUIRE 0u
+#endif
+#if SCPI_TRACE
+#define MEMORY_SIZE_TRACE (SCPI_TRACE_ARENA_POINTS * sizeof(float))
+#else
+#define MEMORY_SIZE_TRACE 0u
+#endif
+#if SCPI_MACRO
+#define MEMORY_SIZE_MACRO SCPI_MACRO_ARENA
+#else
+#define MEMORY_SIZE_MACRO 0u
+#endif
+#if SCPI_SEQUENCE
+#define MEMORY_SIZE_SEQUENCE SCPI_SEQUENCE_TEXT
+#define MEMORY_SIZE_RESULT SCPI_SEQUENCE_RESULT
+#else
+#define MEMORY_SIZE_SEQUENCE 0u
+#define MEMORY_SIZE_RESULT 0u
+#endif
+#define MEMORY_SIZE_LOG (SCPI_LOG_RINGS * SCPI_LOG_DEPTH * sizeof(scpi_log_entry_t))
+
+#define MEMORY_TOTAL(id, name) MEMORY_SIZE_##id +
+_Static_assert((SCPI_MEMORY_BUDGET == 0u) || (SCPI_MEMORY_REGIONS(MEMORY_TOTAL) 0u <= SCPI_MEMORY_BUDGET),
+    "the buffers don't fit SCPI_MEMORY_BUDGET");
+#undef MEMORY_TOTAL
+
+// sizes that depend on each other
+_Static_assert(SCPI_STREAM_PATH_LENGTH < SCPI_INPUT_BUFFER_LENGTH / 2u,
+    "the header path that's put in front of a unit has to leave room for the unit");
+_Static_assert(USBTMC_REPLY_BUFFER_SIZE >= USBTMC_BULK_PACKET_SIZE,
+    "the reply buffer has to take a full Bulk-IN packet");
+_Static_assert(SCPI_ERROR_QUEUE_SIZE >= 2u, "the error queue keeps one entry for queue overflow");
+
+#define MEMORY_SIZE(id, name) [SCPI_MEMORY_##id] = MEMORY_SIZE_##id,
+static const size_t memory_size[SCPI_MEMORY_REGION_COUNT] = {
+    SCPI_MEMORY_REGIONS(MEMORY_SIZE)
+};
+#undef MEMORY_SIZE
+
+#define MEMORY_NAME(id, name) [SCPI_MEMORY_##id] = name,
+static const char * const memory_name[SCPI_MEMORY_REGION_COUNT] = {
+    SCPI_MEMORY_REGIONS(MEMORY_NAME)
+};
+#undef MEMORY_NAME
+
+volatile uint32_t scpi_memory_high_water[SCPI_MEMORY_REGION_COUNT];
+
+/**
+ * SYSTem:MEMory? - for each buffer that's built: name, size and the most it held, in bytes
+ * SYSTem:MEMory:RESet - set the high-water marks to 0
+ */
+scpi_result_t SCPI_SystemMemoryQ(scpi_t * context) {
+    for (size_t i = 0u; i < SCPI_MEMORY_REGION_COUNT; i++) {
+        if (!memory_size[i]) { // an optional subsystem that isn't built
+            continue;
+        }
+        SCPI_ResultMnemonic(context, memory_name[i]);
+        SCPI_ResultUInt32(context, (uint32_t) memory_size[i]);
+        SCPI_ResultUInt32(context, scpi_memory_high_water[i]);
+    }
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_SystemMemoryReset(scpi_t * context) {
+    (void) context;
+    for (size_t i = 0u; i < SCPI_MEMORY_REGION_COUNT; i++) {
+        scpi_memory_high_water[i] = 0u;
+    }
+    return SCPI_RES_OK;
+}
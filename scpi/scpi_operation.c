@@ -0,0 +1,92 @@
+#include "scpi/scpi_operation.h"
+
+#include "scpi/scpi_base.h"
+#include "usb/usbtmc_app.h"
+
+static struct {
+    scpi_operation_poll_t poll;
+    void * context;
+} operations[SCPI_OPERATION_SLOTS];
+static unsigned int operations_pending;
+
+static bool opc_active;     // *OPC received: set OPC in ESR when the pending operations are complete
+
+bool scpi_operation_start(scpi_operation_poll_t poll, void * context) {
+    for (unsigned int i = 0; i < SCPI_OPERATION_SLOTS; i++) {
+        if (operations[i].poll == NULL) {
+            operations[i].context = context;
+            operations[i].poll = poll;
+            operations_pending++;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool scpi_operation_pending() {
+    return operations_pending > 0u;
+}
+
+void scpi_operation_task() {
+    if (!operations_pending) {
+        return;
+    }
+    for (unsigned int i = 0; i < SCPI_OPERATION_SLOTS; i++) {
+        if ((operations[i].poll != NULL) && operations[i].poll(operations[i].context)) {
+            operations[i].poll = NULL;
+            operations_pending--;
+        }
+    }
+    if (!operations_pending && opc_active) {
+        opc_active = false;
+        scpi_t * context = getScpiContext();
+        SCPI_RegSet(context, SCPI_REG_ESR, SCPI_RegGet(context, SCPI_REG_ESR) | ESR_OPC);
+    }
+}
+
+void scpi_operation_clear() {
+    opc_active = false;
+}
+
+// service USB and the operations until none is pending. False if the wait is abandoned (device clear)
+static bool operation_wait() {
+    while (operations_pending) {
+        scpi_operation_task();
+        if (operations_pending && !usbtmc_app_yield()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * *OPC - set OPC in the Standard Event Status Register when all pending operations are complete
+ */
+scpi_result_t My_CoreOpc(scpi_t * context) {
+    if (operations_pending) {
+        opc_active = true;
+    } else {
+        SCPI_RegSet(context, SCPI_REG_ESR, SCPI_RegGet(context, SCPI_REG_ESR) | ESR_OPC);
+    }
+    return SCPI_RES_OK;
+}
+
+/**
+ * *OPC? - reply 1 when all pending operations are complete
+ */
+scpi_result_t My_CoreOpcQ(scpi_t * context) {
+    if (!operation_wait()) {
+        return SCPI_RES_OK;
+    }
+    SCPI_ResultInt32(context, 1);
+    return SCPI_RES_OK;
+}
+
+/**
+ * *WAI - execute the next commands when all pending operations are complete
+ */
+scpi_result_t My_CoreWai(scpi_t * context) {
+    (void) context;
+    operation_wait();
+    return SCPI_RES_OK;
+}
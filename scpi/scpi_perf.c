@@ -0,0 +1,246 @@
+#include "scpi/scpi_perf.h"
+
+#include <string.h>
+
+#include "scpi-def.h"
+#include "scpi/scpi_dispatch.h"
+#include "hardware/timer.h"
+
+typedef enum {
+    PERF_WAIT,
+    PERF_EXECUTE,
+    PERF_REPLY,
+    PERF_STAGES
+} t_perf_stage;
+
+static const scpi_choice_def_t perf_stage_choice[] = {
+    {"WAIT", PERF_WAIT},
+    {"EXECute", PERF_EXECUTE},
+    {"REPLy", PERF_REPLY},
+    SCPI_CHOICE_LIST_END
+};
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t buckets[SCPI_PERF_BUCKETS];
+} t_perf_histogram;
+
+typedef struct {
+    uint16_t command;   // number in the command table
+    t_perf_histogram stage[PERF_STAGES];
+} t_perf_slot;
+
+static t_perf_slot perf_slots[SCPI_PERF_COMMANDS];
+static size_t perf_used;
+
+// message that the SCPI engine executes
+static uint32_t perf_received;
+static uint32_t perf_started;
+static uint32_t perf_execute_begin;
+static uint32_t perf_execute;
+static bool perf_executed;
+static t_perf_slot * perf_slot;
+
+// message whose reply the host is reading. Set by the SCPI engine, taken by the USB side
+static t_perf_slot * volatile perf_reply_slot;
+static uint32_t perf_reply_start;
+
+// Bulk-IN throughput of the replies, from the start of the first transfer to the end of the last
+static uint32_t perf_tx_start;
+static uint32_t perf_tx_bytes;
+static uint32_t perf_tx_last_bytes;
+static uint32_t perf_tx_last_us;
+static uint32_t perf_tx_best;   // bytes/s
+
+// usbtmc_app_idle(): sleeps since perf_idle_since
+static uint64_t perf_idle_since;
+static uint32_t perf_idle_count;
+static uint64_t perf_idle_us;
+static uint32_t perf_idle_max;
+
+static void perf_record(t_perf_histogram * h, uint32_t us) {
+    unsigned int bucket = 0u;
+    for (uint32_t v = us >> 1; v && (bucket < SCPI_PERF_BUCKETS - 1u); v >>= 1) {
+        bucket++;
+    }
+    h->buckets[bucket]++;
+    if (!h->count || (us < h->min)) {
+        h->min = us;
+    }
+    if (us > h->max) {
+        h->max = us;
+    }
+    h->count++;
+}
+
+static t_perf_slot * perf_find(uint16_t command) {
+    for (size_t i = 0u; i < perf_used; i++) {
+        if (perf_slots[i].command == command) {
+            return &perf_slots[i];
+        }
+    }
+    if (perf_used == SCPI_PERF_COMMANDS) {
+        return NULL;
+    }
+    t_perf_slot * slot = &perf_slots[perf_used];
+    memset(slot, 0, sizeof(t_perf_slot));
+    slot->command = command;
+    perf_used++;
+    return slot;
+}
+
+void scpi_perf_message(uint32_t received) {
+    perf_received = received;
+    perf_execute = 0u;
+    perf_executed = false;
+    perf_slot = NULL;
+}
+
+void scpi_perf_execute_begin() {
+    perf_execute_begin = time_us_32();
+    if (!perf_executed) {
+        perf_started = perf_execute_begin;
+        perf_executed = true;
+    }
+}
+
+void scpi_perf_execute_end(const scpi_t * context) {
+    perf_execute += time_us_32() - perf_execute_begin;
+    uint16_t command;
+    if (scpi_dispatch_matched(context, &command)) {
+        perf_slot = perf_find(command);
+    }
+}
+
+void scpi_perf_message_done(bool reply) {
+    if (!perf_executed || (perf_slot == NULL)) {
+        return;
+    }
+    perf_record(&perf_slot->stage[PERF_WAIT], perf_started - perf_received);
+    perf_record(&perf_slot->stage[PERF_EXECUTE], perf_execute);
+    if (reply) {
+        perf_reply_start = time_us_32();
+        perf_reply_slot = perf_slot;
+    }
+}
+
+void scpi_perf_reply_transfer(size_t len, bool first) {
+    if (first) {
+        perf_tx_start = time_us_32();
+        perf_tx_bytes = 0u;
+    }
+    perf_tx_bytes += (uint32_t) len;
+}
+
+// bytes per second, 0 when it took no time
+static uint32_t perf_rate(uint32_t bytes, uint32_t us) {
+    return us ? (uint32_t) (((uint64_t) bytes * 1000000u) / us) : 0u;
+}
+
+void scpi_perf_reply_done() {
+    perf_tx_last_bytes = perf_tx_bytes;
+    perf_tx_last_us = time_us_32() - perf_tx_start;
+    uint32_t rate = perf_rate(perf_tx_last_bytes, perf_tx_last_us);
+    if ((perf_tx_last_bytes >= SCPI_PERF_THROUGHPUT_MIN) && (rate > perf_tx_best)) {
+        perf_tx_best = rate;
+    }
+    t_perf_slot * slot = perf_reply_slot;
+    if (slot != NULL) {
+        perf_reply_slot = NULL;
+        perf_record(&slot->stage[PERF_REPLY], time_us_32() - perf_reply_start);
+    }
+}
+
+void scpi_perf_idle(uint32_t us) {
+    perf_idle_count++;
+    perf_idle_us += us;
+    if (us > perf_idle_max) {
+        perf_idle_max = us;
+    }
+}
+
+void scpi_perf_reset() {
+    perf_idle_since = time_us_64();
+    perf_idle_count = 0u;
+    perf_idle_us = 0u;
+    perf_idle_max = 0u;
+    perf_reply_slot = NULL;
+    perf_slot = NULL;
+    perf_used = 0u;
+    perf_tx_last_bytes = 0u;
+    perf_tx_last_us = 0u;
+    perf_tx_best = 0u;
+}
+
+/**
+ * SYSTem:PERFormance? - per measured command: "pattern", then count,min,max in us
+ *                       of the wait, execute and reply stage
+ */
+scpi_result_t SCPI_SystemPerformanceQ(scpi_t * context) {
+    for (size_t i = 0u; i < perf_used; i++) {
+        SCPI_ResultText(context, scpi_commands[perf_slots[i].command].pattern);
+        for (int s = 0; s < PERF_STAGES; s++) {
+            const t_perf_histogram * h = &perf_slots[i].stage[s];
+            SCPI_ResultUInt32(context, h->count);
+            SCPI_ResultUInt32(context, h->min);
+            SCPI_ResultUInt32(context, h->max);
+        }
+    }
+    return SCPI_RES_OK;
+}
+
+/**
+ * SYSTem:PERFormance:HISTogram? WAIT|EXECute|REPLy - per measured command: "pattern",
+ *                       then the SCPI_PERF_BUCKETS bucket counts of that stage
+ */
+scpi_result_t SCPI_SystemPerformanceHistogramQ(scpi_t * context) {
+    int32_t stage;
+    if (!SCPI_ParamChoice(context, perf_stage_choice, &stage, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    for (size_t i = 0u; i < perf_used; i++) {
+        SCPI_ResultText(context, scpi_commands[perf_slots[i].command].pattern);
+        for (unsigned int b = 0u; b < SCPI_PERF_BUCKETS; b++) {
+            SCPI_ResultUInt32(context, perf_slots[i].stage[stage].buckets[b]);
+        }
+    }
+    return SCPI_RES_OK;
+}
+
+/**
+ * SYSTem:PERFormance:RESet - forget all measurements
+ */
+scpi_result_t SCPI_SystemPerformanceReset(scpi_t * context) {
+    (void) context;
+    scpi_perf_reset();
+    return SCPI_RES_OK;
+}
+
+/**
+ * SYSTem:PERFormance:THRoughput? - Bulk-IN throughput: bytes of the last reply, the us from its
+ *                       first transfer until the host had it all, its bytes/s, and the best bytes/s
+ *                       of a reply from SCPI_PERF_THROUGHPUT_MIN bytes
+ */
+scpi_result_t SCPI_SystemPerformanceThroughputQ(scpi_t * context) {
+    SCPI_ResultUInt32(context, perf_tx_last_bytes);
+    SCPI_ResultUInt32(context, perf_tx_last_us);
+    SCPI_ResultUInt32(context, perf_rate(perf_tx_last_bytes, perf_tx_last_us));
+    SCPI_ResultUInt32(context, perf_tx_best);
+    return SCPI_RES_OK;
+}
+
+/**
+ * SYSTem:PERFormance:IDLE? - usbtmc_app_idle(): sleeps, us asleep, the share of the time asleep
+ *                       in 1/1000, and the longest sleep in us. Compare the wait and reply stages
+ *                       of SYSTem:PERFormance? with SYSTem:IDLE ON and OFF
+ */
+scpi_result_t SCPI_SystemPerformanceIdleQ(scpi_t * context) {
+    uint64_t elapsed = time_us_64() - perf_idle_since;
+    SCPI_ResultUInt32(context, perf_idle_count);
+    SCPI_ResultUInt64(context, perf_idle_us);
+    SCPI_ResultUInt32(context, elapsed ? (uint32_t) ((perf_idle_us * 1000u) / elapsed) : 0u);
+    SCPI_ResultUInt32(context, perf_idle_max);
+    return SCPI_RES_OK;
+}
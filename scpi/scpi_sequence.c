@@ -0,0 +1,243 @@
+#include "scpi/scpi_sequence.h"
+
+#include <string.h>
+
+#include "scpi/scpi_base.h"
+#include "scpi/scpi_dispatch.h"
+#include "hardware/timer.h"
+
+typedef struct {
+    uint32_t dwell;     // us from this step's deadline to the next one's
+    size_t text;        // resolved units in sequence_text
+    size_t text_len;
+    size_t command;     // commands in sequence_commands
+    size_t count;
+} t_step;
+
+static t_step sequence_steps[SCPI_SEQUENCE_STEPS];
+static size_t sequence_step_count;
+static char sequence_text[SCPI_SEQUENCE_TEXT];
+static size_t sequence_text_used;
+static uint16_t sequence_commands[SCPI_SEQUENCE_COMMANDS];
+static size_t sequence_command_used;
+static uint32_t sequence_cycles = 1u; // 0: until SEQuence:ABORt
+
+static bool sequence_active;
+static bool sequence_busy;      // a step is running
+static size_t sequence_next;    // step that's due next
+static uint32_t sequence_cycle;
+static uint64_t sequence_due;
+
+// statistics of the last run
+static uint32_t sequence_executed;
+static uint32_t sequence_late_max;  // us
+static uint32_t sequence_dropped;   // reply bytes that didn't fit
+
+static char sequence_result[SCPI_SEQUENCE_RESULT];
+static size_t sequence_result_len;
+static bool sequence_separator;     // a step's reply ended: ',' before the next one
+
+void scpi_sequence_reset() {
+    sequence_active = false;
+    sequence_step_count = 0u;
+    sequence_text_used = 0u;
+    sequence_command_used = 0u;
+    sequence_cycles = 1u;
+}
+
+static void sequence_put(const char * data, size_t len) {
+    size_t room = SCPI_SEQUENCE_RESULT - sequence_result_len;
+    if (len > room) {
+        sequence_dropped += (uint32_t) (len - room);
+        len = room;
+    }
+    memcpy(&sequence_result[sequence_result_len], data, len);
+    sequence_result_len += len;
+    scpi_memory_use(SCPI_MEMORY_RESULT, sequence_result_len);
+}
+
+// the lib writes the newline that ends a reply on its own
+static void sequence_capture(const char * data, size_t len, void * context) {
+    (void) context;
+    if (((len == 1u) && (data[0] == '\n')) || ((len == 2u) && (data[0] == '\r') && (data[1] == '\n'))) {
+        sequence_separator = true;
+        return;
+    }
+    if (sequence_separator) {
+        sequence_separator = false;
+        sequence_put(",", 1u);
+    }
+    sequence_put(data, len);
+}
+
+void scpi_sequence_task() {
+    if (!sequence_active) {
+        return;
+    }
+    uint64_t now = time_us_64();
+    if ((sequence_due > now) && (sequence_due - now > SCPI_SEQUENCE_SPIN_US)) {
+        usbtmc_app_wake_at(sequence_due - SCPI_SEQUENCE_SPIN_US);
+        return; // serve the host, or sleep, meanwhile
+    }
+    while (now < sequence_due) {
+        now = time_us_64();
+    }
+    uint64_t late = now - sequence_due;
+    if (late > sequence_late_max) {
+        sequence_late_max = (late > UINT32_MAX) ? UINT32_MAX : (uint32_t) late;
+    }
+
+    const t_step * step = &sequence_steps[sequence_next];
+    sequence_due += step->dwell;
+    if (++sequence_next == sequence_step_count) {
+        sequence_next = 0u;
+        if (sequence_cycles && (++sequence_cycle == sequence_cycles)) {
+            sequence_active = false;
+        }
+    }
+    sequence_busy = true;
+    scpi_instrument_execute(&sequence_text[step->text], step->text_len,
+        &sequence_commands[step->command], step->count, sequence_capture, NULL);
+    sequence_busy = false;
+    sequence_executed++;
+    if (sequence_active) {
+        usbtmc_app_wake_at(sequence_due - SCPI_SEQUENCE_SPIN_US);
+    }
+}
+
+static bool sequence_changeable(scpi_t * context) {
+    if (sequence_active || sequence_busy) {
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * SEQuence:CLEar - delete all steps
+ */
+scpi_result_t SCPI_SequenceClear(scpi_t * context) {
+    if (!sequence_changeable(context)) {
+        return SCPI_RES_ERR;
+    }
+    sequence_step_count = 0u;
+    sequence_text_used = 0u;
+    sequence_command_used = 0u;
+    return SCPI_RES_OK;
+}
+
+/**
+ * SEQuence:STEP <dwell>,<units> - add a step at the end: program message units, separated by
+ *      ';', and the time in us until the next step is due
+ */
+scpi_result_t SCPI_SequenceStep(scpi_t * context) {
+    uint32_t dwell;
+    const char * units;
+    size_t len;
+    if (!SCPI_ParamUInt32(context, &dwell, TRUE) || !SCPI_ParamCharacters(context, &units, &len, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    if (!sequence_changeable(context)) {
+        return SCPI_RES_ERR;
+    }
+    if (sequence_step_count == SCPI_SEQUENCE_STEPS) {
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return SCPI_RES_ERR;
+    }
+    t_step * step = &sequence_steps[sequence_step_count];
+    size_t text_len = SCPI_SEQUENCE_TEXT - sequence_text_used;
+    size_t count = SCPI_SEQUENCE_COMMANDS - sequence_command_used;
+    int16_t error;
+    if (!scpi_dispatch_resolve(units, len, &sequence_text[sequence_text_used], &text_len,
+            &sequence_commands[sequence_command_used], &count, &error)) {
+        SCPI_ErrorPush(context, error);
+        return SCPI_RES_ERR;
+    }
+    step->dwell = dwell;
+    step->text = sequence_text_used;
+    step->text_len = text_len;
+    step->command = sequence_command_used;
+    step->count = count;
+    sequence_text_used += text_len;
+    scpi_memory_use(SCPI_MEMORY_SEQUENCE, sequence_text_used);
+    sequence_command_used += count;
+    sequence_step_count++;
+    return SCPI_RES_OK;
+}
+
+/**
+ * SEQuence:STEP:COUNt? - steps in the sequence
+ */
+scpi_result_t SCPI_SequenceStepCountQ(scpi_t * context) {
+    SCPI_ResultUInt32(context, (uint32_t) sequence_step_count);
+    return SCPI_RES_OK;
+}
+
+/**
+ * SEQuence:COUNt <n> - times the steps run. 0: until SEQuence:ABORt. *RST: 1
+ */
+scpi_result_t SCPI_SequenceCount(scpi_t * context) {
+    uint32_t cycles;
+    if (!SCPI_ParamUInt32(context, &cycles, TRUE) || !sequence_changeable(context)) {
+        return SCPI_RES_ERR;
+    }
+    sequence_cycles = cycles;
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_SequenceCountQ(scpi_t * context) {
+    SCPI_ResultUInt32(context, sequence_cycles);
+    return SCPI_RES_OK;
+}
+
+/**
+ * SEQuence:STARt - clear the results and statistics, run the first step when this message is done
+ */
+scpi_result_t SCPI_SequenceStart(scpi_t * context) {
+    if (!sequence_changeable(context)) {
+        return SCPI_RES_ERR;
+    }
+    if (!sequence_step_count) {
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return SCPI_RES_ERR;
+    }
+    sequence_result_len = 0u;
+    sequence_separator = false;
+    sequence_executed = 0u;
+    sequence_late_max = 0u;
+    sequence_dropped = 0u;
+    sequence_next = 0u;
+    sequence_cycle = 0u;
+    sequence_due = time_us_64();
+    sequence_active = true;
+    return SCPI_RES_OK;
+}
+
+/**
+ * SEQuence:ABORt - stop after the step that's running. Results are kept
+ */
+scpi_result_t SCPI_SequenceAbort(scpi_t * context) {
+    (void) context;
+    sequence_active = false;
+    return SCPI_RES_OK;
+}
+
+/**
+ * SEQuence:STATe? - running (0|1), steps executed, the latest start of a step after its
+ *      deadline in us, and reply bytes dropped because the result buffer was full
+ */
+scpi_result_t SCPI_SequenceStateQ(scpi_t * context) {
+    SCPI_ResultBool(context, sequence_active);
+    SCPI_ResultUInt32(context, sequence_executed);
+    SCPI_ResultUInt32(context, sequence_late_max);
+    SCPI_ResultUInt32(context, sequence_dropped);
+    return SCPI_RES_OK;
+}
+
+/**
+ * SEQuence:RESult? - the replies of the steps as the host would have read them, separated by ','
+ */
+scpi_result_t SCPI_SequenceResultQ(scpi_t * context) {
+    SCPI_ResultCharacters(context, sequence_result, sequence_result_len);
+    return SCPI_RES_OK;
+}
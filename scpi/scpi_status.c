@@ -0,0 +1,178 @@
+#include "scpi/scpi_status.h"
+
+#include "scpi/scpi_base.h"
+#include "hardware/sync.h"
+
+// SCPI registers have 15 bits
+#define STATUS_BITS 0x7FFFu
+
+typedef struct {
+    volatile uint16_t condition;
+    volatile uint16_t events;   // passed the filters, not in the SCPI lib's event register yet
+    uint16_t ptr;
+    uint16_t ntr;
+} t_status;
+
+static t_status status[SCPI_STATUS_REGISTER_COUNT];
+static volatile bool status_pending;
+
+static const scpi_reg_name_t status_event_register[SCPI_STATUS_REGISTER_COUNT] = {
+    [SCPI_STATUS_QUESTIONABLE] = SCPI_REG_QUES,
+    [SCPI_STATUS_OPERATION] = SCPI_REG_OPER,
+};
+
+// interrupts off, and in dual core mode the other core out
+#if USBTMC_APP_DUAL_CORE
+static spin_lock_t *status_lock;
+#define status_lock_take() spin_lock_blocking(status_lock)
+#define status_lock_give(save) spin_unlock(status_lock, save)
+#else
+#define status_lock_take() save_and_disable_interrupts()
+#define status_lock_give(save) restore_interrupts(save)
+#endif
+
+static void status_preset() {
+    for (size_t i = 0u; i < SCPI_STATUS_REGISTER_COUNT; i++) {
+        uint32_t save = status_lock_take();
+        status[i].ptr = STATUS_BITS;
+        status[i].ntr = 0u;
+        status_lock_give(save);
+    }
+}
+
+void scpi_status_init() {
+#if USBTMC_APP_DUAL_CORE
+    if (status_lock == NULL) {
+        status_lock = spin_lock_instance(spin_lock_claim_unused(true));
+    }
+#endif
+    status_preset();
+}
+
+static void status_change(scpi_status_register_t reg, uint16_t clear, uint16_t set) {
+    t_status * s = &status[reg];
+    uint32_t save = status_lock_take();
+    uint16_t was = s->condition;
+    uint16_t is = (uint16_t) (((was & ~clear) | set) & STATUS_BITS);
+    s->condition = is;
+    uint16_t events = (uint16_t) ((is & ~was & s->ptr) | (was & ~is & s->ntr));
+    if (events) {
+        s->events |= events;
+        status_pending = true;
+    }
+    status_lock_give(save);
+#if USBTMC_APP_DUAL_CORE
+    if (events) {
+        __sev(); // the SCPI engine may be waiting for work
+    }
+#endif
+}
+
+void scpi_status_set(scpi_status_register_t reg, uint16_t bits) {
+    status_change(reg, 0u, bits);
+}
+
+void scpi_status_clear(scpi_status_register_t reg, uint16_t bits) {
+    status_change(reg, bits, 0u);
+}
+
+uint16_t scpi_status_condition(scpi_status_register_t reg) {
+    return status[reg].condition;
+}
+
+void scpi_status_task() {
+    if (!status_pending) {
+        return;
+    }
+    uint16_t events[SCPI_STATUS_REGISTER_COUNT];
+    uint32_t save = status_lock_take();
+    status_pending = false;
+    for (size_t i = 0u; i < SCPI_STATUS_REGISTER_COUNT; i++) {
+        events[i] = status[i].events;
+        status[i].events = 0u;
+    }
+    status_lock_give(save);
+    scpi_t * context = getScpiContext();
+    for (size_t i = 0u; i < SCPI_STATUS_REGISTER_COUNT; i++) {
+        if (events[i]) { // the lib updates the summary bit in STB, and requests service
+            scpi_reg_name_t name = status_event_register[i];
+            SCPI_RegSet(context, name, SCPI_RegGet(context, name) | events[i]);
+        }
+    }
+}
+
+static scpi_result_t status_filter(scpi_t * context, uint16_t * filter) {
+    int32_t value;
+    if (!SCPI_ParamInt32(context, &value, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    if ((value < 0) || (value > (int32_t) STATUS_BITS)) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+        return SCPI_RES_ERR;
+    }
+    uint32_t save = status_lock_take();
+    *filter = (uint16_t) value;
+    status_lock_give(save);
+    return SCPI_RES_OK;
+}
+
+/**
+ * STATus:QUEStionable:CONDition? - the condition bits as they are now
+ * STATus:QUEStionable:PTRansition <n> - rising condition bits that set their event. PRESet: 32767
+ * STATus:QUEStionable:NTRansition <n> - falling condition bits that set their event. PRESet: 0
+ * the same for STATus:OPERation
+ */
+scpi_result_t SCPI_StatusQuestionableCondQ(scpi_t * context) {
+    SCPI_ResultInt32(context, status[SCPI_STATUS_QUESTIONABLE].condition);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_StatusQuestionablePtr(scpi_t * context) {
+    return status_filter(context, &status[SCPI_STATUS_QUESTIONABLE].ptr);
+}
+
+scpi_result_t SCPI_StatusQuestionablePtrQ(scpi_t * context) {
+    SCPI_ResultInt32(context, status[SCPI_STATUS_QUESTIONABLE].ptr);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_StatusQuestionableNtr(scpi_t * context) {
+    return status_filter(context, &status[SCPI_STATUS_QUESTIONABLE].ntr);
+}
+
+scpi_result_t SCPI_StatusQuestionableNtrQ(scpi_t * context) {
+    SCPI_ResultInt32(context, status[SCPI_STATUS_QUESTIONABLE].ntr);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_StatusOperationCondQ(scpi_t * context) {
+    SCPI_ResultInt32(context, status[SCPI_STATUS_OPERATION].condition);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_StatusOperationPtr(scpi_t * context) {
+    return status_filter(context, &status[SCPI_STATUS_OPERATION].ptr);
+}
+
+scpi_result_t SCPI_StatusOperationPtrQ(scpi_t * context) {
+    SCPI_ResultInt32(context, status[SCPI_STATUS_OPERATION].ptr);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_StatusOperationNtr(scpi_t * context) {
+    return status_filter(context, &status[SCPI_STATUS_OPERATION].ntr);
+}
+
+scpi_result_t SCPI_StatusOperationNtrQ(scpi_t * context) {
+    SCPI_ResultInt32(context, status[SCPI_STATUS_OPERATION].ntr);
+    return SCPI_RES_OK;
+}
+
+/**
+ * STATus:PRESet - the SCPI lib clears the ENABle registers, the transition filters go to
+ * their preset too
+ */
+scpi_result_t SCPI_StatusPresetFilters(scpi_t * context) {
+    status_preset();
+    return SCPI_StatusPreset(context);
+}
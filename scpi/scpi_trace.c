@@ -0,0 +1,248 @@
+#include "scpi/scpi_trace.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include "scpi/scpi_base.h"
+#include "scpi/scpi_format.h"
+
+typedef struct {
+    char name[SCPI_TRACE_NAME_LENGTH + 1u];
+    size_t start;               // first point in the arena
+    size_t size;                // 0: slot is free
+    volatile size_t points;
+} t_trace;
+
+static float trace_arena[SCPI_TRACE_ARENA_POINTS];
+static t_trace traces[SCPI_TRACE_COUNT];
+
+void scpi_trace_reset() {
+    memset(traces, 0, sizeof(traces));
+}
+
+scpi_trace_t scpi_trace_find(const char * name, size_t len) {
+    for (size_t i = 0u; i < SCPI_TRACE_COUNT; i++) {
+        if (traces[i].size && (strlen(traces[i].name) == len) && !strncasecmp(traces[i].name, name, len)) {
+            return (scpi_trace_t) i;
+        }
+    }
+    return SCPI_TRACE_NONE;
+}
+
+// points that a TRACe:DATA? reply still sends straight from the arena: first up to end.
+// They're pinned: no append or new trace may write them. Both 0 when there are none
+static void trace_pinned(size_t * first, size_t * end) {
+    const void * data;
+    size_t len;
+    *first = 0u;
+    *end = 0u;
+    if (!scpi_format_static_pending(&data, &len)) {
+        return;
+    }
+    uintptr_t from = (uintptr_t) data;
+    uintptr_t arena = (uintptr_t) trace_arena;
+    if ((from < arena) || (from >= arena + sizeof(trace_arena))) {
+        return; // not trace points
+    }
+    *first = (size_t) (from - arena) / sizeof(float);
+    *end = *first + ((len + sizeof(float) - 1u) / sizeof(float));
+}
+
+bool scpi_trace_append(scpi_trace_t trace, float point) {
+    if ((trace < 0) || (trace >= (scpi_trace_t) SCPI_TRACE_COUNT)) {
+        return false;
+    }
+    t_trace * t = &traces[trace];
+    size_t points = t->points;
+    if (points >= t->size) {
+        return false;
+    }
+    size_t first;
+    size_t end;
+    trace_pinned(&first, &end);
+    if ((t->start + points >= first) && (t->start + points < end)) {
+        return false; // cleared while its old points are being sent
+    }
+    trace_arena[t->start + points] = point;
+    t->points = points + 1u;
+    return true;
+}
+
+// first gap in the arena that takes size points, next to the traces and the pinned points.
+// SCPI_TRACE_ARENA_POINTS: none
+static size_t trace_fit(size_t size) {
+    size_t pinned_first;
+    size_t pinned_end;
+    trace_pinned(&pinned_first, &pinned_end);
+    size_t at = 0u;
+    while (size <= SCPI_TRACE_ARENA_POINTS - at) {
+        // skip past the furthest end of what overlaps at .. at + size
+        size_t next = at;
+        for (size_t i = 0u; i < SCPI_TRACE_COUNT; i++) {
+            size_t end = traces[i].start + traces[i].size;
+            if (traces[i].size && (traces[i].start < at + size) && (end > next)) {
+                next = end;
+            }
+        }
+        if ((pinned_first < at + size) && (pinned_end > next)) {
+            next = pinned_end;
+        }
+        if (next == at) {
+            return at;
+        }
+        at = next;
+    }
+    return SCPI_TRACE_ARENA_POINTS;
+}
+
+static bool trace_param(scpi_t * context, scpi_trace_t * trace) {
+    const char * name;
+    size_t len;
+    if (!SCPI_ParamCharacters(context, &name, &len, TRUE)) {
+        return false;
+    }
+    *trace = scpi_trace_find(name, len);
+    if (*trace == SCPI_TRACE_NONE) {
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * TRACe:DEFine <name>,<points> - new empty trace with room for <points>
+ */
+scpi_result_t SCPI_TraceDefine(scpi_t * context) {
+    const char * name;
+    size_t len;
+    uint32_t size;
+    if (!SCPI_ParamCharacters(context, &name, &len, TRUE) || !SCPI_ParamUInt32(context, &size, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    if (!len || (len > SCPI_TRACE_NAME_LENGTH) || (scpi_trace_find(name, len) != SCPI_TRACE_NONE)) {
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+        return SCPI_RES_ERR;
+    }
+    if (!size || (size > SCPI_TRACE_ARENA_POINTS)) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+        return SCPI_RES_ERR;
+    }
+    size_t slot = 0u;
+    while ((slot < SCPI_TRACE_COUNT) && traces[slot].size) {
+        slot++;
+    }
+    size_t start = trace_fit(size);
+    if ((slot == SCPI_TRACE_COUNT) || (start == SCPI_TRACE_ARENA_POINTS)) { // out of traces or arena space
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return SCPI_RES_ERR;
+    }
+    t_trace * t = &traces[slot];
+    memcpy(t->name, name, len);
+    t->name[len] = '\0';
+    t->start = start;
+    t->points = 0u;
+    t->size = size;
+    size_t used = 0u;
+    for (size_t i = 0u; i < SCPI_TRACE_COUNT; i++) {
+        used += traces[i].size;
+    }
+    scpi_memory_use(SCPI_MEMORY_TRACE, used * sizeof(float));
+    return SCPI_RES_OK;
+}
+
+/**
+ * TRACe:DELete <name> - remove the trace, its space goes back to the arena
+ * TRACe:DELete:ALL - remove all traces
+ */
+scpi_result_t SCPI_TraceDelete(scpi_t * context) {
+    scpi_trace_t trace;
+    if (!trace_param(context, &trace)) {
+        return SCPI_RES_ERR;
+    }
+    traces[trace].size = 0u;
+    traces[trace].points = 0u;
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_TraceDeleteAll(scpi_t * context) {
+    (void) context;
+    scpi_trace_reset();
+    return SCPI_RES_OK;
+}
+
+/**
+ * TRACe:CLEar <name> - drop the points, keep the trace
+ */
+scpi_result_t SCPI_TraceClear(scpi_t * context) {
+    scpi_trace_t trace;
+    if (!trace_param(context, &trace)) {
+        return SCPI_RES_ERR;
+    }
+    traces[trace].points = 0u;
+    return SCPI_RES_OK;
+}
+
+/**
+ * TRACe:CATalog? - names of the defined traces
+ */
+scpi_result_t SCPI_TraceCatalogQ(scpi_t * context) {
+    for (size_t i = 0u; i < SCPI_TRACE_COUNT; i++) {
+        if (traces[i].size) {
+            SCPI_ResultMnemonic(context, traces[i].name);
+        }
+    }
+    return SCPI_RES_OK;
+}
+
+/**
+ * TRACe:POINts? <name> - points in the trace, and its size
+ */
+scpi_result_t SCPI_TracePointsQ(scpi_t * context) {
+    scpi_trace_t trace;
+    if (!trace_param(context, &trace)) {
+        return SCPI_RES_ERR;
+    }
+    SCPI_ResultUInt32(context, (uint32_t) traces[trace].points);
+    SCPI_ResultUInt32(context, (uint32_t) traces[trace].size);
+    return SCPI_RES_OK;
+}
+
+/**
+ * TRACe:FREE? - points left in the arena, and points in use
+ */
+scpi_result_t SCPI_TraceFreeQ(scpi_t * context) {
+    size_t used = 0u;
+    for (size_t i = 0u; i < SCPI_TRACE_COUNT; i++) {
+        used += traces[i].size;
+    }
+    SCPI_ResultUInt32(context, (uint32_t) (SCPI_TRACE_ARENA_POINTS - used));
+    SCPI_ResultUInt32(context, (uint32_t) used);
+    return SCPI_RES_OK;
+}
+
+/**
+ * TRACe[:DATA]? <name>[,<start>[,<count>]] - <count> points from point <start>, in the FORMat:DATA
+ *                format. Fewer when the trace has less. Default: all points
+ */
+scpi_result_t SCPI_TraceDataQ(scpi_t * context) {
+    scpi_trace_t trace;
+    uint32_t start = 0u;
+    uint32_t count = UINT32_MAX;
+    if (!trace_param(context, &trace)) {
+        return SCPI_RES_ERR;
+    }
+    SCPI_ParamUInt32(context, &start, FALSE);
+    SCPI_ParamUInt32(context, &count, FALSE);
+    const t_trace * t = &traces[trace];
+    size_t points = t->points;
+    if (start > points) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+        return SCPI_RES_ERR;
+    }
+    if (count > points - start) {
+        count = (uint32_t) (points - start);
+    }
+    SCPI_ResultDataArrayFloatStatic(context, &trace_arena[t->start + start], count);
+    return SCPI_RES_OK;
+}
@@ -0,0 +1,234 @@
+#include "scpi/scpi_trigger.h"
+
+#include <string.h>
+
+#include "scpi/scpi_base.h"
+#include "hardware/timer.h"
+#include "usb/usbtmc_app.h"
+#if USBTMC_APP_DUAL_CORE
+#include "hardware/sync.h"
+#endif
+
+typedef enum {
+    TRIGGER_SOURCE_BUS,
+    TRIGGER_SOURCE_IMMEDIATE,
+} trigger_source_t;
+
+static const scpi_choice_def_t trigger_source_choice[] = {
+    {"BUS", TRIGGER_SOURCE_BUS},
+    {"IMMediate", TRIGGER_SOURCE_IMMEDIATE},
+    SCPI_CHOICE_LIST_END
+};
+
+typedef struct {
+    scpi_trigger_action_t action;
+    void * context;
+} trigger_entry_t;
+
+static trigger_entry_t trigger_queue[SCPI_TRIGGER_QUEUE_DEPTH];
+static unsigned int trigger_armed;
+
+static trigger_source_t trigger_source;
+static uint32_t arm_count;
+static volatile uint32_t trigger_remaining;  // triggers to go. 0: idle
+
+static uint64_t trigger_timestamp;           // us since boot, of the last accepted trigger
+static uint32_t trigger_latency;             // us from that trigger until its actions were done
+static uint32_t trigger_latency_max;
+
+// the USB core fires bus triggers while the SCPI engine arms
+#if USBTMC_APP_DUAL_CORE
+static spin_lock_t *trigger_lock;
+#define trigger_lock_take() spin_lock_blocking(trigger_lock)
+#define trigger_lock_give(save) spin_unlock(trigger_lock, save)
+#else
+#define trigger_lock_take() 0u
+#define trigger_lock_give(save) (void) (save)
+#endif
+
+void scpi_trigger_init() {
+#if USBTMC_APP_DUAL_CORE
+    if (trigger_lock == NULL) {
+        trigger_lock = spin_lock_instance(spin_lock_claim_unused(true));
+    }
+#endif
+    trigger_source = TRIGGER_SOURCE_BUS;
+    arm_count = 1u;
+    scpi_trigger_abort();
+}
+
+static void trigger_run(const trigger_entry_t * queue, unsigned int armed) {
+    for (unsigned int i = 0; i < armed; i++) {
+        queue[i].action(queue[i].context);
+    }
+}
+
+// the actions of a trigger at at are done. Call with the lock taken
+static void trigger_done(uint64_t at) {
+    trigger_timestamp = at;
+    trigger_latency = (uint32_t) (time_us_64() - at);
+    if (trigger_latency > trigger_latency_max) {
+        trigger_latency_max = trigger_latency;
+    }
+    if (trigger_remaining && (--trigger_remaining == 0u)) { // ABORt may have come first
+        trigger_armed = 0u;
+    }
+}
+
+// call with the lock taken
+static void trigger_fire(uint64_t at) {
+    trigger_run(trigger_queue, trigger_armed);
+    trigger_done(at);
+}
+
+bool scpi_trigger_arm(scpi_trigger_action_t action, void * context) {
+    bool armed = false;
+    uint32_t save = trigger_lock_take();
+    if (trigger_armed < SCPI_TRIGGER_QUEUE_DEPTH) {
+        trigger_queue[trigger_armed].action = action;
+        trigger_queue[trigger_armed].context = context;
+        trigger_armed++;
+        armed = true;
+    }
+    trigger_lock_give(save);
+    return armed;
+}
+
+bool scpi_trigger_bus() {
+    uint64_t at = time_us_64(); // before anything else: this is the moment of the trigger
+    bool accepted = false;
+    uint32_t save = trigger_lock_take();
+    if (trigger_remaining && (trigger_source == TRIGGER_SOURCE_BUS)) {
+        trigger_fire(at);
+        accepted = true;
+    }
+    trigger_lock_give(save);
+    return accepted;
+}
+
+void scpi_trigger_abort() {
+    uint32_t save = trigger_lock_take();
+    trigger_remaining = 0u;
+    trigger_armed = 0u;
+    trigger_lock_give(save);
+}
+
+static bool trigger_idle(void * context) {
+    (void) context;
+    return trigger_remaining == 0u;
+}
+
+/**
+ * INITiate[:IMMediate] - wait for ARM:COUNt triggers. With source IMMediate, they fire right away
+ */
+scpi_result_t SCPI_Initiate(scpi_t * context) {
+    if (trigger_remaining) { // already initiated
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return SCPI_RES_ERR;
+    }
+    // *OPC follows the trigger system until it's idle: no free operation slot, no INITiate
+    if ((trigger_source != TRIGGER_SOURCE_IMMEDIATE) && !scpi_operation_start(trigger_idle, NULL)) {
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return SCPI_RES_ERR;
+    }
+    trigger_entry_t queue[SCPI_TRIGGER_QUEUE_DEPTH];
+    uint32_t save = trigger_lock_take();
+    unsigned int armed = trigger_armed;
+    memcpy(queue, trigger_queue, armed * sizeof(queue[0]));
+    trigger_remaining = arm_count;
+    trigger_lock_give(save);
+    // the actions run from the copy, without the lock: the USB core isn't kept waiting with
+    // its interrupts off, for up to SCPI_TRIGGER_ARM_COUNT_MAX runs of the queue
+    if (trigger_source == TRIGGER_SOURCE_IMMEDIATE) {
+        while (trigger_remaining) {
+            uint64_t at = time_us_64();
+            trigger_run(queue, armed);
+            save = trigger_lock_take();
+            trigger_done(at);
+            trigger_lock_give(save);
+        }
+    }
+    return SCPI_RES_OK;
+}
+
+/**
+ * ABORt - back to idle, without firing the armed actions
+ */
+scpi_result_t SCPI_Abort(scpi_t * context) {
+    (void) context;
+    scpi_trigger_abort();
+    return SCPI_RES_OK;
+}
+
+/**
+ * ARM[:SEQuence]:COUNt <n> - triggers accepted per INITiate, 1 - SCPI_TRIGGER_ARM_COUNT_MAX. *RST: 1
+ */
+scpi_result_t SCPI_ArmCount(scpi_t * context) {
+    uint32_t count;
+    if (!SCPI_ParamUInt32(context, &count, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    if ((count == 0u) || (count > SCPI_TRIGGER_ARM_COUNT_MAX)) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+        return SCPI_RES_ERR;
+    }
+    arm_count = count;
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_ArmCountQ(scpi_t * context) {
+    SCPI_ResultUInt32(context, arm_count);
+    return SCPI_RES_OK;
+}
+
+/**
+ * TRIGger[:SEQuence]:SOURce BUS|IMMediate - *TRG and USB488 TRIGGER, or no wait. *RST: BUS
+ */
+scpi_result_t SCPI_TriggerSource(scpi_t * context) {
+    int32_t source;
+    if (!SCPI_ParamChoice(context, trigger_source_choice, &source, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    trigger_source = (trigger_source_t) source;
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_TriggerSourceQ(scpi_t * context) {
+    SCPI_ResultMnemonic(context, (trigger_source == TRIGGER_SOURCE_BUS) ? "BUS" : "IMM");
+    return SCPI_RES_OK;
+}
+
+/**
+ * TRIGger[:SEQuence]:TIMestamp? - us since boot of the last accepted trigger. 0: none yet
+ * TRIGger[:SEQuence]:LATency? - us from that trigger until its actions were done, and the maximum
+ */
+scpi_result_t SCPI_TriggerTimestampQ(scpi_t * context) {
+    uint32_t save = trigger_lock_take();
+    uint64_t timestamp = trigger_timestamp;
+    trigger_lock_give(save);
+    SCPI_ResultUInt64(context, timestamp);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_TriggerLatencyQ(scpi_t * context) {
+    uint32_t save = trigger_lock_take();
+    uint32_t latency = trigger_latency;
+    uint32_t latency_max = trigger_latency_max;
+    trigger_lock_give(save);
+    SCPI_ResultUInt32(context, latency);
+    SCPI_ResultUInt32(context, latency_max);
+    return SCPI_RES_OK;
+}
+
+/**
+ * *TRG - This command asserts trigger.
+ *        https://www.ni.com/docs/en-US/bundle/labview-api-ref/page/functions/visa-assert-trigger.html
+ *        ignored when the trigger system isn't waiting for a BUS trigger
+ * @param context
+ * @return
+ */
+scpi_result_t SCPI_VisaTrg(scpi_t * context) {
+    (void) context;
+    scpi_trigger_bus();
+    return SCPI_RES_OK;
+}
@@ -87,7 +87,7 @@ uint8_t const * tud_descriptor_device_cb(void)
 //  compatibility with mcus that only allow 8, 16, 32 or 64 for FS endpoints
 #  define TUD_USBTMC_DESC(_itfnum, _bulkMaxPacketLength) \
      TUD_USBTMC_DESC_MAIN(_itfnum, /* _epCount = */ 3, _bulkMaxPacketLength), \
-     TUD_USBTMC_INT_DESCRIPTOR(/* INT ep # */ 0x82, /* epMaxSize = */ 8, /* bInterval = */16u )
+     TUD_USBTMC_INT_DESCRIPTOR(/* INT ep # */ USBTMC_INT_EP_IN, /* epMaxSize = */ 8, /* bInterval = */ USBTMC_INT_EP_INTERVAL )
 #  define TUD_USBTMC_DESC_LEN (TUD_USBTMC_IF_DESCRIPTOR_LEN + TUD_USBTMC_BULK_DESCRIPTORS_LEN + TUD_USBTMC_INT_DESCRIPTOR_LEN)
 
 #else
@@ -102,14 +102,27 @@ uint8_t const * tud_descriptor_device_cb(void)
 #  define USBTMC_DESC_LEN (0)
 #endif /* CFG_TUD_USBTMC */
 
+#if CFG_TUD_VENDOR
+// raw bulk pipe for the acquisition stream. No string: the application owns the string table
+#  define USB_STREAM_DESC(_itfnum, _bulkMaxPacketLength) \
+     TUD_VENDOR_DESCRIPTOR(_itfnum, /* _stridx = */ 0u, USB_STREAM_EP_OUT, USB_STREAM_EP_IN, _bulkMaxPacketLength),
+#  define USB_STREAM_DESC_LEN TUD_VENDOR_DESC_LEN
+#else
+#  define USB_STREAM_DESC(_itfnum, _bulkMaxPacketLength)
+#  define USB_STREAM_DESC_LEN (0)
+#endif /* CFG_TUD_VENDOR */
+
 enum
 {
   ITF_NUM_USBTMC,
+#if CFG_TUD_VENDOR
+  ITF_NUM_STREAM,
+#endif
   ITF_NUM_TOTAL
 };
 
 
-#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + TUD_USBTMC_DESC_LEN)
+#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + TUD_USBTMC_DESC_LEN + USB_STREAM_DESC_LEN)
 
 #if CFG_TUSB_MCU == OPT_MCU_LPC175X_6X || CFG_TUSB_MCU == OPT_MCU_LPC177X_8X || CFG_TUSB_MCU == OPT_MCU_LPC40XX
   // LPC 17xx and 40xx endpoint type (bulk/interrupt/iso) are fixed by its number
@@ -128,6 +141,7 @@ uint8_t const desc_fs_configuration[] =
   TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x00, 100),
 
   TUD_USBTMC_DESC(ITF_NUM_USBTMC, /* _bulkMaxPacketLength = */ 64),
+  USB_STREAM_DESC(ITF_NUM_STREAM, /* _bulkMaxPacketLength = */ 64)
 };
 
 #if TUD_OPT_HIGH_SPEED
@@ -138,6 +152,7 @@ uint8_t const desc_hs_configuration[] =
   TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x00, 100),
 
   TUD_USBTMC_DESC(ITF_NUM_USBTMC, /* _bulkMaxPacketLength = */ 512),
+  USB_STREAM_DESC(ITF_NUM_STREAM, /* _bulkMaxPacketLength = */ 512)
 };
 
 // other speed configuration
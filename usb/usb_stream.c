@@ -0,0 +1,76 @@
+#include "usb/usb_stream.h"
+
+#include "tusb.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include "pico/platform.h"
+#include "scpi/scpi_acquire.h"
+
+static volatile bool stream_on;
+static volatile bool stream_busy;     // the USB side is taking samples
+static volatile uint32_t stream_bytes;
+
+bool usb_stream_available(void) {
+  return CFG_TUD_VENDOR != 0;
+}
+
+bool usb_stream_enable(bool on) {
+  if (on) {
+    stream_bytes = 0u;
+  }
+  stream_on = on;
+  __dmb();
+  // a stream that's switched off doesn't touch the ring anymore, once the USB side ends its pass
+  uint64_t until = time_us_64() + USB_STREAM_RELEASE_US;
+  while (!on && stream_busy) {
+    if (time_us_64() >= until) {
+      return false;
+    }
+    tight_loop_contents();
+  }
+  return true;
+}
+
+bool usb_stream_enabled(void) {
+  return stream_on;
+}
+
+bool usb_stream_connected(void) {
+#if CFG_TUD_VENDOR
+  return tud_vendor_mounted();
+#else
+  return false;
+#endif
+}
+
+uint32_t usb_stream_bytes(void) {
+  return stream_bytes;
+}
+
+void usb_stream_task(void) {
+#if CFG_TUD_VENDOR
+  stream_busy = true;
+  __dmb();
+  if (stream_on && tud_vendor_mounted()) {
+    // samples the host doesn't take stay in the ring, the producer counts the overruns
+    bool sent = false;
+    for (;;) {
+      const int16_t *data;
+      uint32_t len = (uint32_t) scpi_acquire_peek(&data);
+      len = tu_min32(len, tud_vendor_write_available() / sizeof(int16_t));
+      if (!len) {
+        break;
+      }
+      tud_vendor_write(data, len * sizeof(int16_t));
+      scpi_acquire_release(len);
+      stream_bytes += len * sizeof(int16_t);
+      sent = true;
+    }
+    if (sent) {
+      tud_vendor_write_flush();
+    }
+  }
+  __dmb();
+  stream_busy = false;
+#endif
+}
@@ -5,9 +5,8 @@
 #include <stdbool.h>
 
 #include "bsp/board.h"
-
-
-#include "bsp/board.h"
+#include "hardware/timer.h"
+#include "usb/usbtmc_app.h"
 
 //--------------------------------------------------------------------+
 // MACRO CONSTANT TYPEDEF PROTYPES
@@ -37,6 +36,14 @@ void led_indicator_pulse(void) {
 	doPulse = true;
 }
 
+// the main loop may sleep in usbtmc_app_idle(): ask to be called again when the LED changes
+static void led_wake_after(uint32_t start_ms, uint32_t interval_ms)
+{
+  uint32_t elapsed = board_millis() - start_ms;
+  uint32_t left = (elapsed < interval_ms) ? (interval_ms - elapsed) : 0u;
+  usbtmc_app_wake_at(time_us_64() + (uint64_t) left * 1000u);
+}
+
 void led_blinking_task(void)
 {
   static uint32_t start_ms = 0;
@@ -49,11 +56,13 @@ void led_blinking_task(void)
       board_led_write(true);
       start_ms = board_millis();
       doPulse = false;
+      led_wake_after(start_ms, 750);
     }
     else if (led_state == true)
     {
       if ( board_millis() - start_ms < 750) //Spec says blink must be between 500 and 1000 ms.
       {
+        led_wake_after(start_ms, 750);
         return; // not enough time
       }
       led_state = false;
@@ -63,11 +72,15 @@ void led_blinking_task(void)
   else
   {
     // Blink every interval ms
-    if ( board_millis() - start_ms < blink_interval_ms) return; // not enough time
+    if ( board_millis() - start_ms < blink_interval_ms) {
+      led_wake_after(start_ms, blink_interval_ms);
+      return; // not enough time
+    }
     start_ms += blink_interval_ms;
 
     board_led_write(led_state);
     led_state = 1 - led_state; // toggle
+    led_wake_after(start_ms, blink_interval_ms);
   }
 }
 
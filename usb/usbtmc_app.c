@@ -27,13 +27,34 @@
 #include <stdlib.h>     /* atoi */
 #include "tusb.h"
 #include "bsp/board.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include "pico/time.h"
 
 #include "usb/usb_utils.h"
 
 #include "usb/usbtmc_device_custom.h"
+#include "usb/usbtmc_app.h"
+#include "usb/usb_stream.h"
 #include "scpi-def.h"
 #include "scpi/scpi_base.h"
 
+#if USBTMC_APP_DUAL_CORE
+#include "pico/multicore.h"
+// data handed between the cores is published after a memory barrier
+#define core_barrier() __dmb()
+#define executor_wake() __sev()
+// the USB core may sleep in usbtmc_app_idle()
+#define usb_wake() __sev()
+#define USBTMC_EXECUTOR_CORE 1u
+#define app_core() get_core_num()
+#else
+#define core_barrier()
+#define executor_wake()
+#define usb_wake()
+#define app_core() 0u
+#endif
+
 #if (CFG_TUD_USBTMC_ENABLE_488)
 static usbtmc_response_capabilities_488_t const
 #else
@@ -50,7 +71,7 @@ tud_usbtmc_app_capabilities  =
         .supportsIndicatorPulse = 1
     },
     .bmDevCapabilities = {
-        .canEndBulkInOnTermChar = 0
+        .canEndBulkInOnTermChar = 1
     },
 
 #if (CFG_TUD_USBTMC_ENABLE_488)
@@ -76,22 +97,81 @@ tud_usbtmc_app_capabilities  =
 #define IEEE4882_STB_SER          (0x20u)
 #define IEEE4882_STB_SRQ          (0x40u)
 
+// USB488 4.3.1: a query that can't get its reply out because the host keeps sending
+#define IEEE4882_ERROR_QUERY_DEADLOCKED (-430)
+
 typedef enum {
     ready_for_scpi_cmd,
     scpi_cmd_received,
     ready_to_reply
 } t_querystate;
 
-char reply[256];
-size_t reply_len;
-bool query_received;
-
 static volatile t_querystate queryState = ready_for_scpi_cmd;
 static volatile bool bulkInStarted;
-
-static size_t buffer_len;
-static size_t buffer_tx_ix; // for transmitting using multiple transfers
-static uint8_t buffer[225]; // A few packets long should be enough.
+static unsigned int msgReqLen;
+static bool msgTermCharEnabled; // the Bulk-IN request ends at msgTermChar
+static uint8_t msgTermChar;
+
+static bool outArmed;     // Bulk-OUT endpoint can take the next packet
+
+// Bulk-OUT packets, from the USB callbacks to the SCPI engine.
+// Single producer (USB) and single consumer (SCPI engine). In dual core mode, each runs on its own core.
+// Free running counters. One slot is kept free, for the packet that the class driver can
+// receive right after a device clear.
+typedef struct {
+  uint8_t data[USBTMC_BULK_PACKET_SIZE];
+  size_t len;
+  bool first;   // first packet of a message
+  bool last;    // last packet of a transfer
+  bool eom;     // ... and the transfer has END set
+  uint32_t received; // time_us_32()
+} t_rxpacket;
+
+static t_rxpacket rx_queue[USBTMC_RX_QUEUE_DEPTH];
+_Static_assert((USBTMC_RX_QUEUE_DEPTH & (USBTMC_RX_QUEUE_DEPTH - 1u)) == 0u,
+    "USBTMC_RX_QUEUE_DEPTH must be a power of 2");
+static volatile size_t rx_head;         // USB side
+static volatile size_t rx_tail;         // SCPI engine
+// device clear or Bulk-OUT abort: the SCPI engine drops its input, and the packets up to rx_clear_head
+static volatile size_t rx_clear_head;
+static volatile bool rx_clear_device;   // device clear, not only the Bulk-OUT message
+static volatile unsigned int rx_clear_count;
+static unsigned int rx_clear_seen;
+
+static bool msgStart;     // the next data callback is the start of a message
+static bool msgEOM;       // END flag of the Bulk-OUT message that's being received
+static bool rxTransferDone = true; // the SCPI engine has all packets of the current transfer
+
+// Reply ring buffer. The SCPI lib writes at head, Bulk-IN transfers take from tail.
+// Free running counters, the position in the buffer is counter % size.
+static uint8_t reply_buffer[USBTMC_REPLY_BUFFER_SIZE];
+_Static_assert((USBTMC_REPLY_BUFFER_SIZE & (USBTMC_REPLY_BUFFER_SIZE - 1u)) == 0u,
+    "USBTMC_REPLY_BUFFER_SIZE must be a power of 2");
+static volatile size_t reply_head;
+static volatile size_t reply_tail;
+static volatile size_t reply_tx_len;  // bytes in the Bulk-IN transfer that's on the bus
+static volatile bool reply_tx_eom;
+static volatile bool reply_active;    // MAV: there is a reply the host hasn't fully read
+static volatile bool reply_complete;  // the message that generates the reply is executed
+static volatile bool reply_discard;   // clear, abort or a new message: drop the rest of the reply
+static volatile bool reply_tx_block;  // the Bulk-IN transfer on the bus comes from the block producer
+static volatile bool reply_flush;     // the SCPI engine waits for the host to read a full ring buffer
+static size_t reply_sent;             // bytes of the reply that went to a Bulk-IN transfer
+static volatile bool reply_stream;    // throughput mode: send parts of a reply while it's written
+
+static volatile bool idle_on = true;
+// earliest time_us_64() that a task of each core asked to run again. 0: none
+static uint64_t wake_time[USBTMC_APP_DUAL_CORE ? 2u : 1u];
+
+// definite length block that is pulled from its producer when the host reads,
+// instead of being copied through the ring buffer. It sits at position 'at' of the reply.
+static struct {
+  usbtmc_block_producer_t producer;
+  void *context;
+  size_t at;
+  size_t len;
+  size_t offset;
+} reply_block;
 
 
 static usbtmc_msg_dev_dep_msg_in_header_t rspMsg = {
@@ -102,10 +182,323 @@ static usbtmc_msg_dev_dep_msg_in_header_t rspMsg = {
     }
 };
 
+#if USBTMC_APP_DUAL_CORE
+// The SCPI lib's registers belong to the executor core. The USB core queues its STB changes
+// under the status lock, and reads the copy that the executor publishes.
+static spin_lock_t *status_lock;
+static uint8_t stb_published;
+static uint8_t sre_published;
+static uint8_t stb_clear_pending;
+static uint8_t stb_set_pending;
+#endif
+// a service request waits for the interrupt endpoint. Status changes that come in
+// before the endpoint is free go out as one notification, with the latest STB.
+static volatile bool srq_pending;
+
+// change STB bits, from the USB side or the SCPI engine. Returns the STB before the change.
+static uint8_t stb_change(uint8_t clear, uint8_t set) {
+#if USBTMC_APP_DUAL_CORE
+  uint32_t save = spin_lock_blocking(status_lock);
+  uint8_t status;
+  if (get_core_num() == USBTMC_EXECUTOR_CORE) {
+    status = (uint8_t)((getSTB() & ~stb_clear_pending) | stb_set_pending);
+    if (stb_clear_pending || stb_set_pending || clear || set) {
+      setSTB((uint8_t)((status & ~clear) | set));
+    }
+    stb_clear_pending = 0u;
+    stb_set_pending = 0u;
+    stb_published = getSTB();
+    sre_published = (uint8_t) SCPI_RegGet(getScpiContext(), SCPI_REG_SRE);
+  } else {
+    status = stb_published;
+    stb_clear_pending = (uint8_t)((stb_clear_pending | clear) & ~set);
+    stb_set_pending = (uint8_t)((stb_set_pending & ~clear) | set);
+    stb_published = (uint8_t)((status & ~clear) | set);
+    // RQS follows the *SRE mask, the way the SCPI lib keeps it on the executor side
+    if (stb_published & sre_published & (uint8_t) ~IEEE4882_STB_SRQ) {
+      stb_published |= IEEE4882_STB_SRQ;
+    } else {
+      stb_published &= (uint8_t) ~IEEE4882_STB_SRQ;
+    }
+  }
+  spin_unlock(status_lock, save);
+  if ((clear | set) && (get_core_num() != USBTMC_EXECUTOR_CORE)) {
+    executor_wake(); // the executor applies the change to the SCPI lib's registers
+  }
+  return status;
+#else
+  uint8_t status = getSTB();
+  setSTB((uint8_t)((status & ~clear) | set));
+  return status;
+#endif
+}
+
+static size_t reply_count() {
+  return reply_head - reply_tail;
+}
+
+static size_t rx_free() {
+  return USBTMC_RX_QUEUE_DEPTH - (rx_head - rx_tail);
+}
+
+static void clearMAV() {
+  stb_change(IEEE4882_STB_MAV, 0u);
+}
+
+static void reply_reset() {
+  reply_head = 0u;
+  reply_tail = 0u;
+  reply_tx_len = 0u;
+  reply_tx_eom = false;
+  reply_complete = false;
+  reply_discard = false;
+  reply_tx_block = false;
+  reply_flush = false;
+  reply_sent = 0u;
+  reply_block.producer = NULL;
+  if (reply_active) {
+    reply_active = false;
+    clearMAV();
+  }
+}
+
+// the USB side gives up the reply (clear, abort or a new message).
+// the SCPI engine stops writing it, and resets the ring buffer when it starts the next message.
+static void reply_drop() {
+  reply_discard = true;
+  reply_sent = 0u;
+  reply_tx_len = 0u;
+  reply_tx_eom = false;
+  reply_complete = false;
+  if (reply_active) {
+    reply_active = false;
+    clearMAV();
+  }
+}
+
+// device clear or Bulk-OUT abort: let the SCPI engine drop the input it has
+static void rx_request_clear(bool device) {
+  rx_clear_head = rx_head;
+  rx_clear_device = device;
+  core_barrier();
+  rx_clear_count++;
+  executor_wake();
+}
+
+// SCPI engine side of rx_request_clear()
+static bool rx_sync_clear() {
+  if (rx_clear_seen == rx_clear_count) {
+    return false;
+  }
+  rx_clear_seen = rx_clear_count;
+  core_barrier();
+  rx_tail = rx_clear_head;
+  rxTransferDone = true;
+  scpi_instrument_input_clear();
+  if (rx_clear_device) {
+    scpi_operation_clear();
+  }
+  return true;
+}
+
+// arm the Bulk-OUT endpoint, if the packet queue has room and no Bulk-IN transfer is going on
+static void bus_read() {
+  if (!outArmed && (rx_free() > 1u) && !bulkInStarted && !reply_tx_len) {
+    outArmed = tud_usbtmc_start_bus_read();
+  }
+}
+
+// hand the next part of the reply to a Bulk-IN transfer.
+// the TinyUSB class sends straight from the ring buffer or the block producer's memory,
+// so the part has to be contiguous. EOM only goes with the last part.
+// When the host asked for it, the transfer ends after the TermChar. The rest waits for the next request.
+static bool reply_transmit() {
+  if (!bulkInStarted || reply_tx_len || !reply_active) {
+    return false;
+  }
+  size_t count = reply_count();
+  core_barrier();
+  const uint8_t *data;
+  size_t len;
+  if (reply_block.producer && (reply_tail == reply_block.at)) {
+    len = reply_block.producer(reply_block.context, reply_block.offset,
+        tu_min32(reply_block.len - reply_block.offset, msgReqLen), &data);
+    if (!len) { // producer has nothing yet, ask again later
+      return false;
+    }
+    len = tu_min32(len, reply_block.len - reply_block.offset);
+    reply_tx_block = true;
+  } else {
+    size_t until = reply_block.producer ? (reply_block.at - reply_tail) : count; // stop at the block
+    if (!until && !reply_complete) {
+      return false;
+    }
+    size_t pos = reply_tail & (USBTMC_REPLY_BUFFER_SIZE - 1u);
+    len = tu_min32(until, USBTMC_REPLY_BUFFER_SIZE - pos);
+    len = tu_min32(len, msgReqLen);
+    data = &reply_buffer[pos];
+    reply_tx_block = false;
+  }
+  bool term_char = false;
+  if (msgTermCharEnabled) {
+    const uint8_t *end = memchr(data, msgTermChar, len);
+    if (end != NULL) {
+      len = (size_t) (end - data) + 1u;
+      term_char = true;
+    }
+  }
+  if (reply_tx_block) {
+    reply_tx_eom = reply_complete && !count && ((reply_block.offset + len) == reply_block.len);
+  } else {
+    reply_tx_eom = reply_complete && !reply_block.producer && (len == count);
+  }
+  reply_tx_len = len;
+  bulkInStarted = false;
+  scpi_perf_reply_transfer(len, !reply_sent);
+  reply_sent += len;
+  // a zero length transfer only happens to deliver a late EOM
+  return tud_usbtmc_transmit_dev_msg_data(data, len, reply_tx_eom, term_char);
+}
+
+// a reply that's still being written has a part to send
+static bool reply_streaming() {
+  return reply_flush || (reply_stream && (reply_count() >= USBTMC_REPLY_STREAM_THRESHOLD));
+}
+
+void usbtmc_app_set_throughput(bool on) {
+  reply_stream = on;
+}
+
+bool usbtmc_app_throughput(void) {
+  return reply_stream;
+}
+
+// the ring buffer is full: let the host read, while the SCPI engine waits
+static void reply_wait() {
+  reply_flush = true;
+  usb_wake(); // once: SEV sets this core's event flag too, the first WFE below falls through
+  while (!reply_discard && (reply_count() == USBTMC_REPLY_BUFFER_SIZE)) {
+    if (!rxTransferDone) {
+      // the host is still writing, it will not read. IEEE 488.2 6.3.1.7
+      SCPI_ErrorPush(getScpiContext(), IEEE4882_ERROR_QUERY_DEADLOCKED);
+      reply_discard = true;
+    } else if ((rx_head != rx_tail) || !tud_mounted()) {
+      // a new message instead of a read, or gone
+      reply_discard = true;
+    } else {
+#if USBTMC_APP_DUAL_CORE
+      // the USB core transmits. Keep the published STB fresh for READ_STB
+      stb_change(0u, 0u);
+      __wfe();
+#else
+      bus_read(); // the host's Bulk-IN request comes in over Bulk-OUT
+      reply_transmit();
+      tud_task();
+#endif
+    }
+    rx_sync_clear();
+  }
+  reply_flush = false;
+}
+
+// feed the next received packet to the SCPI engine. Returns false if there was none
+static bool usbtmc_app_input() {
+  size_t head = rx_head;
+  core_barrier();
+  if (rx_sync_clear() || (head == rx_tail) || (queryState == scpi_cmd_received)) {
+    return false; // the USB side didn't pick up the previous message's reply yet
+  }
+  t_rxpacket *rx = &rx_queue[rx_tail & (USBTMC_RX_QUEUE_DEPTH - 1u)];
+  uint8_t packet[USBTMC_BULK_PACKET_SIZE];
+  size_t len = rx->len;
+  bool first = rx->first;
+  bool last = rx->last;
+  bool eom = rx->eom;
+  uint32_t received = rx->received;
+  memcpy(packet, rx->data, len);
+  core_barrier();
+  rx_tail++; // free for the next one
+
+  if (first) { // a new message: start a new reply
+    reply_reset();
+    scpi_perf_message(received);
+  }
+  rxTransferDone = last;
+  // commands that are complete execute right away, also when the transfer continues
+  scpi_instrument_input((const char *) packet, (int) len);
+  if (last) {
+    if (eom) {
+      scpi_instrument_input_end();
+    }
+    scpi_perf_message_done(reply_active && !reply_discard);
+    core_barrier();
+    queryState = scpi_cmd_received;
+  }
+  return true;
+}
+
+void usbtmc_app_wake_at(uint64_t time) {
+  uint64_t *wake = &wake_time[app_core()];
+  if (!*wake || (time < *wake)) {
+    *wake = time;
+  }
+}
+
+void usbtmc_app_wake(void) {
+  __sev();
+}
+
+static uint64_t wake_take() {
+  uint64_t wake = wake_time[app_core()];
+  wake_time[app_core()] = 0u;
+  return wake;
+}
+
+#if USBTMC_APP_DUAL_CORE
+// core 1: runs the SCPI engine, the USB core keeps servicing the bus.
+static void usbtmc_app_executor() {
+  while (true) {
+    scpi_status_task();
+    stb_change(0u, 0u); // publish STB for READ_STB
+    scpi_operation_task();
+#if SCPI_SEQUENCE
+    scpi_sequence_task();
+#endif
+    bool input = usbtmc_app_input();
+    uint64_t wake = wake_take();
+    if (input) {
+      usb_wake(); // a reply to send, or room in the packet queue
+    } else if (!scpi_operation_pending()) {
+      if (wake) { // a sequence step is due
+        best_effort_wfe_or_timeout(from_us_since_boot(wake));
+      } else {
+        __wfe();
+      }
+    }
+  }
+}
+
+void usbtmc_app_start_executor(void) {
+  status_lock = spin_lock_instance(spin_lock_claim_unused(true));
+  stb_published = getSTB();
+  multicore_launch_core1(usbtmc_app_executor);
+}
+#endif
+
+bool usbtmc_app_yield(void) {
+#if USBTMC_APP_DUAL_CORE
+  stb_change(0u, 0u); // the USB core runs on its own
+#else
+  tud_task();
+#endif
+  return !rx_sync_clear() && tud_mounted();
+}
+
 void tud_usbtmc_open_cb(uint8_t interface_id)
 {
   (void)interface_id;
-  tud_usbtmc_start_bus_read();
+  outArmed = false;
+  bus_read();
 }
 
 #if (CFG_TUD_USBTMC_ENABLE_488)
@@ -121,139 +514,142 @@ tud_usbtmc_get_capabilities_cb()
 
 bool tud_usbtmc_msg_trigger_cb(usbtmc_msg_generic_t* msg) {
   (void)msg;
-  doTrigger();
-  // TODO: check if this is TinyUSB example code, or needed
-  // TODO: locks usb communication after trigger, 
-  // until a usbtmc clear command is sent
-  // not related with adding the doTrigger() call above...
-  // it also fails and time outs in the TinyUSB example program
-  // is this related with setting the SCPI-LIB STB below?
-  // Let trigger set the SRQ
-  uint8_t status = getSTB();
-  status |= IEEE4882_STB_SRQ;
-  setSTB(status);
-
+  scpi_log(SCPI_LOG_TRIGGER, 0);
+  // the armed actions run right here, not after a trip through the SCPI engine
+  scpi_trigger_bus();
+  // the class driver leaves Bulk-OUT NAKed after a TRIGGER message. Without this
+  // re-arm, the bus locked up until a device clear
+  outArmed = false;
+  bus_read();
   return true;
 }
 
 bool tud_usbtmc_msgBulkOut_start_cb(usbtmc_msg_request_dev_dep_out const * msgHeader)
 {
-  (void)msgHeader;
-  buffer_len = 0;
-  if(msgHeader->TransferSize > sizeof(buffer))
-  {
-
-    return false;
-  }
+  // no size limit: the message is streamed into the SCPI parser packet by packet
+  msgEOM = msgHeader->bmTransferAttributes.EOM;
+  msgStart = true;
   return true;
 }
 
 bool tud_usbtmc_msg_data_cb(void *data, size_t len, bool transfer_complete)
 {
-  // If transfer isn't finished, we just ignore it (for now)
-
-  if(len + buffer_len < sizeof(buffer))
-  {
-    memcpy(&(buffer[buffer_len]), data, len);
-    buffer_len += len;
-  }
-  else
-  {
-    return false; // buffer overflow!
-  }
-  queryState = transfer_complete ? scpi_cmd_received : ready_for_scpi_cmd;
-  reply_len = 0;
-  query_received = false;
-
-  if(transfer_complete && (len >=1) /* && !strncasecmp("*idn?",data,4) */) // we received a query
-  {
-    query_received = true;
-    scpi_instrument_input(data, len);
+  // the endpoint isn't armed when the queue is full
+  TU_VERIFY((rx_free() > 0u) && (len <= USBTMC_BULK_PACKET_SIZE));
+  outArmed = false;
+  if (msgStart) { // a new message discards an unread reply
+    reply_drop();
   }
-  tud_usbtmc_start_bus_read();
+  t_rxpacket *rx = &rx_queue[rx_head & (USBTMC_RX_QUEUE_DEPTH - 1u)];
+  memcpy(rx->data, data, len);
+  rx->len = len;
+  rx->first = msgStart;
+  rx->last = transfer_complete;
+  rx->eom = transfer_complete && msgEOM;
+  rx->received = time_us_32();
+  msgStart = false;
+  core_barrier();
+  rx_head++;
+  scpi_memory_use(SCPI_MEMORY_RX, (rx_head - rx_tail) * USBTMC_BULK_PACKET_SIZE);
+  executor_wake();
+  // no tud_usbtmc_start_bus_read() here: usbtmc_app_task_iter() does that while the queue has room.
   return true;
 }
 
 bool tud_usbtmc_msgBulkIn_complete_cb()
 {
-  if((buffer_tx_ix == buffer_len) || query_received) // done
+  if (reply_tx_block) {
+    reply_block.offset += reply_tx_len;
+    if (reply_block.offset == reply_block.len) {
+      reply_block.producer = NULL;
+    }
+  } else {
+    reply_tail += reply_tx_len;
+  }
+  reply_tx_len = 0u;
+  if(reply_tx_eom) // done
   {
-    uint8_t status = getSTB();
-    status &= (uint8_t)~(IEEE4882_STB_MAV); // clear MAV
-    setSTB(status);
+    reply_tx_eom = false;
+    reply_active = false;
+    reply_complete = false;
+    clearMAV();
+    scpi_perf_reply_done();
     queryState = ready_for_scpi_cmd;
-    bulkInStarted = false;
-    buffer_tx_ix = 0;
-    query_received = false;
   }
-  tud_usbtmc_start_bus_read();
+  executor_wake(); // room in the ring buffer
+  bus_read();
 
   return true;
 }
 
-static unsigned int msgReqLen;
-
 bool tud_usbtmc_msgBulkIn_request_cb(usbtmc_msg_request_dev_dep_in const * request)
 {
   rspMsg.header.MsgID = request->header.MsgID,
   rspMsg.header.bTag = request->header.bTag,
   rspMsg.header.bTagInverse = request->header.bTagInverse;
   msgReqLen = request->TransferSize;
+  msgTermCharEnabled = request->bmTransferAttributes.TermCharEnabled;
+  msgTermChar = request->TermChar;
+  outArmed = false;
 
 #ifdef xDEBUG
   uart_tx_str_sync("MSG_IN_DATA: Requested!\r\n");
 #endif
-  if(queryState == ready_for_scpi_cmd || (buffer_tx_ix == 0))
-  {
-    TU_ASSERT(bulkInStarted == false);
-    bulkInStarted = true;
+  TU_ASSERT(bulkInStarted == false);
+  bulkInStarted = true;
 
-    // > If a USBTMC interface receives a Bulk-IN request prior to receiving a USBTMC command message
-    //   that expects a response, the device must NAK the request (*not stall*)
-  }
-  else
-  {
-    size_t txlen = tu_min32(buffer_len-buffer_tx_ix,msgReqLen);
-    tud_usbtmc_transmit_dev_msg_data(&buffer[buffer_tx_ix], txlen,
-        (buffer_tx_ix+txlen) == buffer_len, false);
-    buffer_tx_ix += txlen;
-  }
+  // > If a USBTMC interface receives a Bulk-IN request prior to receiving a USBTMC command message
+  //   that expects a response, the device must NAK the request (*not stall*)
   // Always return true indicating not to stall the EP.
   return true;
 }
 
 void usbtmc_app_task_iter(void) {
+#if !USBTMC_APP_DUAL_CORE
+  scpi_status_task();
+  usbtmc_app_input(); // the SCPI engine runs here, unless it has its own core
+  scpi_operation_task();
+#if SCPI_SEQUENCE
+  scpi_sequence_task();
+#endif
+#endif
   switch(queryState) {
   case ready_for_scpi_cmd:
     break;
-  case scpi_cmd_received:
-    queryState = ready_to_reply;
-    break;
-  case 2: // time to transmit;
-    if(bulkInStarted &&  (buffer_tx_ix == 0)) {
-      if(reply_len) // if this was a SCPI query, there will be a reply.
-      {
-        tud_usbtmc_transmit_dev_msg_data(reply,  tu_min32(reply_len,msgReqLen),true,false);
-        queryState = ready_for_scpi_cmd;
-        bulkInStarted = false;
-        reply_len = 0;
-      }
-      else
-      {
-        buffer_tx_ix = tu_min32(buffer_len,msgReqLen);
-        tud_usbtmc_transmit_dev_msg_data(buffer, buffer_tx_ix, buffer_tx_ix == buffer_len, false);
-      }
-      // MAV is cleared in the transfer complete callback.
-    }
-    if((queryState == ready_to_reply) && (!reply_len)) { // we didn't get a reply from SCPI lib
+  case scpi_cmd_received: // the message is executed. Everything that's in the ring buffer is the reply.
+    if (reply_active && !reply_discard) {
+      reply_complete = true;
+      queryState = ready_to_reply;
+    } else {
       queryState = ready_for_scpi_cmd; // if the lib didn't reply, it means the scpi sentence didn't generate one
     }
-
+    executor_wake();
+    break;
+  case ready_to_reply: // time to transmit;
+    // in one or more transfers, as the host's TransferSize allows.
+    // MAV is cleared in the transfer complete callback of the last one.
+    reply_transmit();
     break;
   default:
     TU_ASSERT(false,);
     return;
   }
+#if USBTMC_APP_DUAL_CORE
+  if (reply_streaming()) { // the executor is writing a long reply, or waits for room
+    reply_transmit();
+  }
+#endif
+  if (srq_pending) {
+    srq_pending = false; // before the STB is read: a later change flags a new one
+    core_barrier();
+    if (!tud_usbtmc_send_srq()) {
+      srq_pending = true; // endpoint busy, try again next time
+    }
+  }
+  bus_read(); // as soon as the queue has room again
+#if SCPI_ACQUIRE
+  usb_stream_task();
+#endif
 }
 
 bool tud_usbtmc_initiate_clear_cb(uint8_t *tmcResult)
@@ -261,40 +657,44 @@ bool tud_usbtmc_initiate_clear_cb(uint8_t *tmcResult)
   *tmcResult = USBTMC_STATUS_SUCCESS;
   queryState = ready_for_scpi_cmd;
   bulkInStarted = false;
-  uint8_t status = getSTB();
-  status = 0;
-  setSTB(status);
+  stb_change(0xFFu, 0u);
   return true;
 }
 
 bool tud_usbtmc_check_clear_cb(usbtmc_get_clear_status_rsp_t *rsp)
 {
+  scpi_log(SCPI_LOG_CLEAR, 0);
   queryState = ready_for_scpi_cmd;
   bulkInStarted = false;
-  uint8_t status = getSTB();
-  status = 0;
-  setSTB(status);
-  buffer_tx_ix = 0u;
-  buffer_len = 0u;
+  stb_change(0xFFu, 0u);
+  srq_pending = false;
+  rx_request_clear(true);
+  reply_drop(); // a command that's still executing loses its output
+  outArmed = true; // the class driver arms Bulk-OUT after a successful clear
   rsp->USBTMC_status = USBTMC_STATUS_SUCCESS;
   rsp->bmClear.BulkInFifoBytes = 0u;
   return true;
 }
 bool tud_usbtmc_initiate_abort_bulk_in_cb(uint8_t *tmcResult)
 {
+  scpi_log(SCPI_LOG_ABORT_IN, 0);
   bulkInStarted = false;
+  reply_drop();
+  queryState = ready_for_scpi_cmd;
   *tmcResult = USBTMC_STATUS_SUCCESS;
   return true;
 }
 bool tud_usbtmc_check_abort_bulk_in_cb(usbtmc_check_abort_bulk_rsp_t *rsp)
 {
   (void)rsp;
-  tud_usbtmc_start_bus_read();
+  outArmed = false;
+  bus_read();
   return true;
 }
 
 bool tud_usbtmc_initiate_abort_bulk_out_cb(uint8_t *tmcResult)
 {
+  scpi_log(SCPI_LOG_ABORT_OUT, 0);
   *tmcResult = USBTMC_STATUS_SUCCESS;
   return true;
 
@@ -302,7 +702,10 @@ bool tud_usbtmc_initiate_abort_bulk_out_cb(uint8_t *tmcResult)
 bool tud_usbtmc_check_abort_bulk_out_cb(usbtmc_check_abort_bulk_rsp_t *rsp)
 {
   (void)rsp;
-  tud_usbtmc_start_bus_read();
+  // drop the partial message
+  rx_request_clear(false);
+  outArmed = false;
+  bus_read();
   return true;
 }
 
@@ -311,16 +714,14 @@ void tud_usbtmc_bulkIn_clearFeature_cb(void)
 }
 void tud_usbtmc_bulkOut_clearFeature_cb(void)
 {
-  tud_usbtmc_start_bus_read();
+  outArmed = false;
+  bus_read();
 }
 
 // Return status byte, but put the transfer result status code in the rspResult argument.
 uint8_t tud_usbtmc_get_stb_cb(uint8_t *tmcResult)
 {
-  uint8_t status = getSTB();
-  uint8_t old_status = status;
-  status = (uint8_t)(status & ~(IEEE4882_STB_SRQ)); // clear SRQ
-  setSTB(status);
+  uint8_t old_status = stb_change(IEEE4882_STB_SRQ, 0u); // clear SRQ
 
   *tmcResult = USBTMC_STATUS_SUCCESS;
 
@@ -335,21 +736,143 @@ bool tud_usbtmc_indicator_pulse_cb(tusb_control_request_t const * msg, uint8_t *
   return true;
 }
 
+static void setMAV() {
+  reply_active = true;
+  stb_change(0u, IEEE4882_STB_MAV);
+}
+
 void setReply (const char *data, size_t len) {
-  // attach replies to the buffer until the SCPI engine is finished.
-  // no one should run away with the data, because only one core has focus 
-  // on scpi engine and USB state machine 
+  // attach replies to the ring buffer until the SCPI engine is finished.
+  // when it's full, wait for the host to read a part. So a reply can be any size.
   // on getting the first data, set MAV
 
-  if (!reply_len) { // set MAV when first part of command written (i.e.: buffer still empty)
-    uint8_t status = getSTB();
-    status |= 0x10u; // MAV
-    setSTB(status);
+  if (reply_discard) {
+    return;
+  }
+  if (!reply_active) { // set MAV when first part of command written (i.e.: buffer still empty)
+    setMAV();
+  }
+  while (len) {
+    if (reply_count() == USBTMC_REPLY_BUFFER_SIZE) {
+      reply_wait();
+      if (reply_discard) {
+        return;
+      }
+    }
+    size_t pos = reply_head & (USBTMC_REPLY_BUFFER_SIZE - 1u);
+    size_t part = tu_min32(len, USBTMC_REPLY_BUFFER_SIZE - pos);
+    part = tu_min32(part, USBTMC_REPLY_BUFFER_SIZE - reply_count());
+    memcpy(&reply_buffer[pos], data, part);
+    core_barrier();
+    reply_head += part;
+    scpi_memory_use(SCPI_MEMORY_REPLY, reply_count());
+    data += part;
+    len -= part;
+  }
+#if !USBTMC_APP_DUAL_CORE
+  if (!reply_tx_len && reply_streaming()) { // the host reads a part while the rest is written
+    tud_task();
+    reply_transmit();
+  }
+#else
+  if (reply_streaming()) {
+    usb_wake();
+  }
+#endif
+}
+
+void setReplyBlock (size_t len, usbtmc_block_producer_t producer, void *context) {
+  // the block data goes out when the host reads, straight from the producer's memory.
+  // what the SCPI engine writes after this goes into the ring buffer, and is sent after the block.
+
+  if (reply_discard || !len) {
+    return;
+  }
+  if (reply_block.producer) {
+    // one block can be pending per reply. Copy the next ones through the ring buffer.
+    for (size_t offset = 0u; (offset < len) && !reply_discard;) {
+      const uint8_t *data;
+      size_t part = producer(context, offset, tu_min32(len - offset, USBTMC_REPLY_BUFFER_SIZE), &data);
+      if (!part) {
+        reply_wait();
+        continue;
+      }
+      part = tu_min32(part, len - offset);
+      setReply((const char *) data, part);
+      offset += part;
+    }
+    return;
+  }
+  if (!reply_active) {
+    setMAV();
+  }
+  reply_block.context = context;
+  reply_block.at = reply_head;
+  reply_block.len = len;
+  reply_block.offset = 0u;
+  core_barrier();
+  reply_block.producer = producer;
+}
+
+bool usbtmc_app_block_pending(usbtmc_block_producer_t producer, void **context, size_t *len) {
+  if (reply_block.producer != producer) {
+    return false;
   }
-  memcpy(reply + (reply_len * sizeof reply[0]), data, len);
-  reply_len += len;
+  core_barrier(); // set before the producer, see setReplyBlock()
+  *context = reply_block.context;
+  *len = reply_block.len;
+  return true;
 }
 
 void setControlReply () {
-  tud_usbtmc_send_srq();
+  srq_pending = true; // usbtmc_app_task_iter() sends it when the interrupt endpoint is free
+  usb_wake();
+}
+
+// the USB side can't wait for an interrupt: it has a step to take, or it polls
+static bool usb_busy() {
+  if (queryState == scpi_cmd_received) {
+    return true;
+  }
+  if (reply_active && bulkInStarted && !reply_tx_len) { // the host waits, the reply has nothing to send yet
+    return true;
+  }
+#if !USBTMC_APP_DUAL_CORE
+  if ((rx_head != rx_tail) || scpi_operation_pending()) { // the SCPI engine runs in this loop
+    return true;
+  }
+#endif
+  return false;
+}
+
+uint64_t usbtmc_app_idle(void) {
+  // keep the wake time posted for the next call while there's still work to do
+  if (!idle_on || usb_busy() || tud_task_event_ready()) {
+    return 0u;
+  }
+  uint64_t wake = wake_take();
+  uint64_t now = time_us_64();
+  if (!wake || (wake > now + USBTMC_APP_IDLE_MAX_US)) {
+    wake = now + USBTMC_APP_IDLE_MAX_US;
+  }
+  if (wake <= now) {
+    return 0u;
+  }
+  // an interrupt between the checks and the WFE sets the event flag: the WFE doesn't wait
+  best_effort_wfe_or_timeout(from_us_since_boot(wake));
+  uint64_t woke = time_us_64();
+  scpi_perf_idle((uint32_t) (woke - now));
+  return woke;
+}
+
+bool usbtmc_app_pending(void) {
+  return usb_busy();
+}
+
+void usbtmc_app_set_idle(bool on) {
+  idle_on = on;
+}
+
+bool usbtmc_app_idle_enabled(void) {
+  return idle_on;
 }
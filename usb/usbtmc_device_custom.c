@@ -1,4 +1,3 @@
-
 #include "usb/usbtmc_device_custom.h"
 #include "device/usbd_pvt.h"
 
@@ -6,43 +5,27 @@
 #if (CFG_TUD_USBTMC_ENABLE_488)
 // I based this on the PICO definition in tusb_config.h
 #define PATCH_usbtmc_state_rhport (BOARD_TUD_RHPORT)
-// I based this on the PICO definition in usb_descriptors.c
-#define PATCH_usbtmc_state_ep_int_in (0x82)
-bool tud_usbtmc_send_srq(void) 
+
+#if (CFG_TUD_USBTMC_ENABLE_INT_EP)
+// the controller reads the message when the host polls the endpoint, long after
+// tud_usbtmc_send_srq() returned: it can't live on the stack
+static usbtmc_read_stb_interrupt_488_t srq_msg;
+#endif
+
+bool tud_usbtmc_send_srq(void)
+{
+#if (CFG_TUD_USBTMC_ENABLE_INT_EP)
+  if (usbd_edpt_busy(PATCH_usbtmc_state_rhport, USBTMC_INT_EP_IN))
   {
-    usbtmc_read_stb_rsp_488_t rsp;
-    
-    rsp.bTag = 0x01; //Indicates SRQ
-    if (PATCH_usbtmc_state_ep_int_in != 0)  // see patch defines above
-    {
-      rsp.statusByte = 0x00; // Use interrupt endpoint, instead. Must be 0x00 (USB488v1.0 4.3.1.2)
-      // if(usbd_edpt_busy(usbtmc_state.rhport, usbtmc_state.ep_int_in))
-      if(usbd_edpt_busy(PATCH_usbtmc_state_rhport,PATCH_usbtmc_state_ep_int_in)) // see patch defines above
-      {
-        rsp.USBTMC_status = USB488_STATUS_INTERRUPT_IN_BUSY;
-      }
-      else
-      {
-        rsp.USBTMC_status = USBTMC_STATUS_SUCCESS;
-        usbtmc_read_stb_interrupt_488_t intMsg =
-        {
-          .bNotify1 = {
-              .one = 1,
-              .bTag = 0x01 //Indicates SRQ
-          },
-          .StatusByte = tud_usbtmc_get_stb_cb(&(rsp.USBTMC_status))
-        };
-        // Must be queued before control request response sent (USB488v1.0 4.3.1.2)
-        // usbd_edpt_xfer(usbtmc_state.rhport, usbtmc_state.ep_int_in, (void*)&intMsg, sizeof(intMsg));
-        usbd_edpt_xfer(PATCH_usbtmc_state_rhport, PATCH_usbtmc_state_ep_int_in, (void*)&intMsg, sizeof(intMsg)); // see patch defines above
-      }
-    }
-    else
-    {
-      rsp.statusByte = tud_usbtmc_get_stb_cb(&(rsp.USBTMC_status));
-    }
-    //TU_VERIFY(tud_control_xfer(usbtmc_state.rhport, request, (void*)&rsp, sizeof(rsp)));
-    return true;
+    return false; // the caller tries again when the previous notification is out
   }
+  uint8_t tmcResult;
+  srq_msg.bNotify1.one = 1;
+  srq_msg.bNotify1.bTag = 0x01; //Indicates SRQ (USB488v1.0 3.4.2)
+  srq_msg.StatusByte = tud_usbtmc_get_stb_cb(&tmcResult);
+  return usbd_edpt_xfer(PATCH_usbtmc_state_rhport, USBTMC_INT_EP_IN, (uint8_t *)&srq_msg, sizeof(srq_msg));
+#else
+  return false; // no interrupt endpoint: the host has to poll READ_STATUS_BYTE
+#endif
+}
 #endif
-
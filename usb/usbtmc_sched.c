@@ -0,0 +1,210 @@
+#include "usb/usbtmc_sched.h"
+
+#include <string.h>
+
+#include "tusb.h"
+#include "hardware/timer.h"
+#include "usb/usb_utils.h"
+#include "usb/usbtmc_app.h"
+
+typedef struct {
+  const char *name;
+  usbtmc_sched_task_t task;
+  usbtmc_sched_pending_t pending;
+  void *context;
+  uint8_t priority;
+  uint32_t period;      // us, 0: polled
+  uint32_t deadline;    // us after release, 0: none
+  uint64_t release;     // time_us_64() that the task is due
+  bool ran;             // in this pass
+  // statistics
+  uint32_t runs;
+  uint64_t busy;
+  uint32_t longest;
+  uint32_t missed;
+} t_sched_task;
+
+static t_sched_task sched_task[USBTMC_SCHED_TASKS];
+static size_t sched_count;
+static bool sched_lib;
+static volatile bool sched_reset;
+// when the previous pass woke up from usbtmc_app_idle(): the start of this pass. 0: it didn't sleep,
+// this pass reads the clock
+static uint64_t sched_now;
+
+static void sched_usb(void *context) {
+  (void) context;
+  tud_task();
+}
+
+static bool sched_usb_pending(void *context) {
+  (void) context;
+  return tud_task_event_ready();
+}
+
+static void sched_scpi(void *context) {
+  (void) context;
+  usbtmc_app_task_iter();
+}
+
+static bool sched_scpi_pending(void *context) {
+  (void) context;
+  return usbtmc_app_pending();
+}
+
+static void sched_led(void *context) {
+  (void) context;
+  led_blinking_task();
+}
+
+void usbtmc_sched_init(void) {
+  if (sched_lib) {
+    return;
+  }
+  sched_lib = true;
+  usbtmc_sched_set_pending(usbtmc_sched_add("USB", sched_usb, NULL, USBTMC_SCHED_PRIORITY_USB, 0u, USBTMC_SCHED_USB_DEADLINE_US),
+      sched_usb_pending);
+  usbtmc_sched_set_pending(usbtmc_sched_add("SCPI", sched_scpi, NULL, USBTMC_SCHED_PRIORITY_SCPI, 0u, 0u),
+      sched_scpi_pending);
+  usbtmc_sched_add("LED", sched_led, NULL, USBTMC_SCHED_PRIORITY_LED, USBTMC_SCHED_LED_PERIOD_US, 0u);
+}
+
+int usbtmc_sched_add(const char *name, usbtmc_sched_task_t task, void *context,
+    uint8_t priority, uint32_t period, uint32_t deadline) {
+  if (sched_count == USBTMC_SCHED_TASKS) {
+    return -1;
+  }
+  t_sched_task *t = &sched_task[sched_count];
+  memset(t, 0, sizeof(*t));
+  t->name = name;
+  t->task = task;
+  t->context = context;
+  t->priority = priority;
+  t->period = period;
+  t->deadline = (deadline || !period) ? deadline : period;
+  t->release = time_us_64();
+  return (int) sched_count++;
+}
+
+void usbtmc_sched_set_pending(int index, usbtmc_sched_pending_t pending) {
+  if ((index >= 0) && ((size_t) index < sched_count)) {
+    sched_task[index].pending = pending;
+  }
+}
+
+// absolute deadline, for the order within a priority
+static uint64_t sched_due(const t_sched_task *t) {
+  return t->deadline ? (t->release + t->deadline) : UINT64_MAX;
+}
+
+static t_sched_task *sched_pick(uint64_t now) {
+  t_sched_task *pick = NULL;
+  for (size_t i = 0u; i < sched_count; i++) {
+    t_sched_task *t = &sched_task[i];
+    if (t->ran || (t->release > now)) {
+      continue;
+    }
+    if ((pick == NULL) || (t->priority < pick->priority) ||
+        ((t->priority == pick->priority) && (sched_due(t) < sched_due(pick)))) {
+      pick = t;
+    }
+  }
+  return pick;
+}
+
+// returns the time it finished. A task that had no work pending isn't timed: it only looks,
+// so the next task starts at the same time. A pass still reads the clock once, when it begins
+static uint64_t sched_execute(t_sched_task *t, uint64_t start) {
+  bool timed = (t->pending == NULL) || t->pending(t->context);
+  t->task(t->context);
+  uint64_t end = timed ? time_us_64() : start;
+  uint32_t took = (uint32_t) (end - start);
+  t->runs++;
+  t->busy += took;
+  if (took > t->longest) {
+    t->longest = took;
+  }
+  if (t->deadline && (end > t->release + t->deadline)) {
+    t->missed++;
+  }
+  t->ran = true;
+  if (t->period) {
+    t->release += t->period;
+    if (t->release <= end) { // overrun: the releases that went by are skipped, and missed
+      uint64_t behind = ((end - t->release) / t->period) + 1u;
+      t->missed += (uint32_t) behind;
+      t->release += behind * t->period;
+    }
+  } else {
+    t->release = end;
+  }
+  // the polled tasks above this one that have work get their turn before the next task
+  for (size_t i = 0u; i < sched_count; i++) {
+    t_sched_task *u = &sched_task[i];
+    if (u->ran && !u->period && (u->priority < t->priority) && (u->pending != NULL) && u->pending(u->context)) {
+      u->ran = false;
+    }
+  }
+  return end;
+}
+
+void usbtmc_sched_run(void) {
+  if (sched_reset) {
+    for (size_t i = 0u; i < sched_count; i++) {
+      sched_task[i].runs = 0u;
+      sched_task[i].busy = 0u;
+      sched_task[i].longest = 0u;
+      sched_task[i].missed = 0u;
+    }
+    sched_reset = false;
+  }
+  for (size_t i = 0u; i < sched_count; i++) {
+    sched_task[i].ran = false;
+  }
+  uint64_t now = sched_now ? sched_now : time_us_64();
+  t_sched_task *t;
+  while ((t = sched_pick(now)) != NULL) {
+    now = sched_execute(t, now);
+  }
+
+  for (size_t i = 0u; i < sched_count; i++) {
+    if (sched_task[i].period) {
+      usbtmc_app_wake_at(sched_task[i].release);
+    }
+  }
+  now = usbtmc_app_idle();
+  sched_now = now;
+  if (!now) {
+    return;
+  }
+  // time asleep doesn't count against the polled tasks' deadlines
+  for (size_t i = 0u; i < sched_count; i++) {
+    if (!sched_task[i].period && (sched_task[i].release < now)) {
+      sched_task[i].release = now;
+    }
+  }
+}
+
+size_t usbtmc_sched_count(void) {
+  return sched_count;
+}
+
+bool usbtmc_sched_stats(size_t index, usbtmc_sched_stats_t *stats) {
+  if (index >= sched_count) {
+    return false;
+  }
+  const t_sched_task *t = &sched_task[index];
+  stats->name = t->name;
+  stats->priority = t->priority;
+  stats->period = t->period;
+  stats->deadline = t->deadline;
+  stats->runs = t->runs;
+  stats->busy = t->busy;
+  stats->longest = t->longest;
+  stats->missed = t->missed;
+  return true;
+}
+
+void usbtmc_sched_reset(void) {
+  sched_reset = true;
+}